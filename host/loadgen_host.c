@@ -0,0 +1,70 @@
+#include "loadgen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_SIZE 1025
+#define STEP_MS 5000
+#define BATCH_MS 2000 // Loki's flush interval, the floor of the delivery latency
+
+// Runs the generator and the ramp against a simulated device that drops
+// whatever it gets over capacity lines/s, its latency growing with the load.
+// usage: loadgen_host [capacity] [min_len] [max_len]
+int main(int argc, char **argv) {
+  uint32_t capacity = argc > 1 ? strtoul(argv[1], NULL, 10) : 3700;
+  const loadgen_limits_t limits = {
+    .min_rate = 50,
+    .max_rate = 20000,
+    .max_latency_ms = 5000,
+    .max_drops = 0,
+    .min_len = argc > 2 ? atoi(argv[2]) : 0,
+    .max_len = argc > 3 ? atoi(argv[3]) : 0,
+  };
+  char line[LINE_SIZE];
+  loadgen_ramp_t ramp;
+  loadgen_step_t step;
+  loadgen_t gen;
+  size_t len;
+
+  if (!capacity) {
+    fprintf(stderr, "usage: %s [capacity] [min_len] [max_len]\n", argv[0]);
+    return 2;
+  }
+  loadgen_ramp_init(&ramp, &limits);
+  loadgen_init(&gen, 1, ramp.limits.min_len, ramp.limits.max_len);
+  for (int i = 0; i < 100000; i++) {
+    len = loadgen_line(&gen, i, line, sizeof(line));
+    if (len != strlen(line) || len >= sizeof(line)) {
+      printf("FAIL: line %d is %zu bytes, strlen %zu\n", i, len, strlen(line));
+      return 1;
+    }
+    if (i < 5) printf("%s\n", line);
+  }
+
+  while (ramp.rate) {
+    memset(&step, 0, sizeof(step));
+    step.rate = ramp.rate;
+    step.elapsed_ms = STEP_MS;
+    step.lines = step.rate * STEP_MS / 1000;
+    for (uint32_t i = 0; i < step.lines; i++) step.bytes += loadgen_line(&gen, i, line, sizeof(line));
+    step.dropped = step.rate > capacity ? (step.rate - capacity) * STEP_MS / 1000 : 0;
+    step.p50_ms = BATCH_MS / 2 + (uint64_t) 1000 * step.rate / capacity;
+    step.p95_ms = BATCH_MS + (uint64_t) 1000 * step.rate / capacity;
+    step.p99_ms = step.p95_ms + 100;
+    loadgen_ramp_step(&ramp, &step);
+    printf("step %d: %u lines/s, %u dropped, p95 %u ms -> next %u\n", ramp.steps, step.rate, step.dropped, step.p95_ms, ramp.rate);
+    if (ramp.steps > 64) {
+      printf("FAIL: the ramp doesn't converge\n");
+      return 1;
+    }
+  }
+  printf("sustained %u lines/s (%u bytes/s), over the limits at %u, p95 %u ms after %d steps\n",
+         ramp.pass_rate, ramp.bytes_per_s, ramp.fail_rate, ramp.p95_ms, ramp.steps);
+  if (ramp.pass_rate > capacity || (capacity >= limits.min_rate && capacity < limits.max_rate &&
+      (ramp.fail_rate <= capacity || ramp.pass_rate < capacity * 8 / 10))) {
+    printf("FAIL: expected a pass rate within 20%% under %u\n", capacity);
+    return 1;
+  }
+  return 0;
+}
@@ -3,5 +3,9 @@
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
-COMPONENT_EMBED_FILES := esp-tail.png
-COMPONENT_EMBED_TXTFILES := index.html
+# index.html is served gzip-compressed, the png is already deflated
+COMPONENT_EMBED_FILES := esp-tail.png $(COMPONENT_BUILD_DIR)/index.html.gz
+COMPONENT_EXTRA_CLEAN := index.html.gz
+
+$(COMPONENT_BUILD_DIR)/index.html.gz: $(COMPONENT_PATH)/index.html $(COMPONENT_PATH)/gzip_asset.py
+	$(PYTHON) $(COMPONENT_PATH)/gzip_asset.py $< $@
@@ -0,0 +1,171 @@
+#include "filter.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include <string.h>
+
+typedef struct {
+  filter_rule_t rule;
+  uint32_t matched;
+  uint32_t dropped;
+  time_t window;
+  uint32_t window_cnt;
+} filter_slot_t;
+
+typedef struct {
+  char tag[FILTER_TAG_SIZE];
+  int8_t rule[LOG_LEVELS];
+} filter_bucket_t;
+
+// Rules compiled into a lookup table: a rule index per level for tag-less
+// rules and an open-addressing hash of tags, each with a rule index per level.
+typedef struct {
+  int8_t level_rule[LOG_LEVELS];
+  filter_bucket_t buckets[FILTER_TAG_BUCKETS];
+  filter_slot_t slots[FILTER_RULES_MAX];
+  int slots_num;
+} filter_table_t;
+
+static const char *TAG = "filter";
+// The active table is swapped under the spinlock, a new rule set is compiled
+// into the inactive one so the UART task never waits on it.
+static filter_table_t tables[2];
+static int active = 0;
+static portMUX_TYPE filter_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t apply_mutex = NULL;
+
+static uint32_t tag_hash(const char *tag) {
+  uint32_t hash = LOG_HASH_INIT;
+  while (*tag) hash = log_hash_add(hash, (uint8_t) *tag++);
+  return hash;
+}
+
+static filter_bucket_t *tag_bucket(filter_table_t *table, const char *tag, bool insert) {
+  uint32_t idx = tag_hash(tag) % FILTER_TAG_BUCKETS;
+  for (int i = 0; i < FILTER_TAG_BUCKETS; i++) {
+    filter_bucket_t *bucket = &table->buckets[(idx + i) % FILTER_TAG_BUCKETS];
+    if (bucket->tag[0] == '\0') {
+      if (!insert) return NULL;
+      strlcpy(bucket->tag, tag, FILTER_TAG_SIZE);
+      return bucket;
+    }
+    if (!strcmp(bucket->tag, tag)) return bucket;
+  }
+  return NULL;
+}
+
+// "I (1234) tag: message" -> "tag"
+static void extract_tag(const char *line, char *tag) {
+  const char *start = strstr(line, ") ");
+  int len = 0;
+  tag[0] = '\0';
+  if (!start) return;
+  start += 2;
+  while (start[len] && start[len] != ':' && len < FILTER_TAG_SIZE - 1) len++;
+  if (start[len] != ':') return;
+  memcpy(tag, start, len);
+  tag[len] = '\0';
+}
+
+static void compile_rules(filter_table_t *table, const filters_cfg_t *config) {
+  memset(table, 0, sizeof(filter_table_t));
+  memset(table->level_rule, -1, sizeof(table->level_rule));
+  for (int i = 0; i < config->rules_num && i < FILTER_RULES_MAX; i++) {
+    const filter_rule_t *rule = &config->rules[i];
+    int8_t *target = table->level_rule;
+    if (rule->tag[0] != '\0') {
+      filter_bucket_t *bucket = tag_bucket(table, rule->tag, false);
+      if (!bucket) {
+        bucket = tag_bucket(table, rule->tag, true);
+        if (!bucket) continue;
+        memset(bucket->rule, -1, sizeof(bucket->rule));
+      }
+      target = bucket->rule;
+    }
+    table->slots[table->slots_num].rule = *rule;
+    // The first rule for a level wins
+    for (int l = 0; l < LOG_LEVELS; l++) {
+      if (target[l] >= 0) continue;
+      if (rule->level == '*' || l == log_level_idx(rule->level)) target[l] = table->slots_num;
+    }
+    table->slots_num++;
+  }
+}
+
+static bool slot_check(filter_slot_t *slot, const log_data_t *frame) {
+  bool keep;
+  slot->matched++;
+  switch(slot->rule.action) {
+    case FILTER_DROP:
+      keep = false;
+      break;
+    case FILTER_SAMPLE:
+      keep = slot->rule.arg <= 1 || (slot->matched - 1) % slot->rule.arg == 0;
+      break;
+    case FILTER_RATE:
+      if (slot->window != frame->tv.tv_sec) {
+        slot->window = frame->tv.tv_sec;
+        slot->window_cnt = 0;
+      }
+      keep = slot->window_cnt++ < slot->rule.arg;
+      break;
+    default:
+      keep = true;
+  }
+  if (!keep) slot->dropped++;
+  return keep;
+}
+
+bool filter_check(const log_data_t *frame) {
+  char tag[FILTER_TAG_SIZE];
+  int level = log_level_idx(frame->level);
+  bool keep = true;
+
+  if (frame->level) extract_tag(frame->log_line, tag);
+  else tag[0] = '\0';
+
+  portENTER_CRITICAL(&filter_mux);
+  filter_table_t *table = &tables[active];
+  int8_t rule = -1;
+  if (table->slots_num) {
+    if (tag[0] != '\0') {
+      filter_bucket_t *bucket = tag_bucket(table, tag, false);
+      if (bucket) rule = bucket->rule[level];
+    }
+    if (rule < 0) rule = table->level_rule[level];
+    if (rule >= 0) keep = slot_check(&table->slots[rule], frame);
+  }
+  portEXIT_CRITICAL(&filter_mux);
+  return keep;
+}
+
+void filter_apply(const filters_cfg_t *config) {
+  if (!apply_mutex) apply_mutex = xSemaphoreCreateMutex();
+  xSemaphoreTake(apply_mutex, portMAX_DELAY);
+  compile_rules(&tables[!active], config);
+  portENTER_CRITICAL(&filter_mux);
+  active = !active;
+  portEXIT_CRITICAL(&filter_mux);
+  xSemaphoreGive(apply_mutex);
+  ESP_LOGI(TAG, "%d rules applied", tables[active].slots_num);
+}
+
+int filter_get_stats(filter_stat_t *stats, int max) {
+  int num = 0;
+  portENTER_CRITICAL(&filter_mux);
+  filter_table_t *table = &tables[active];
+  for (; num < table->slots_num && num < max; num++) {
+    stats[num].rule = table->slots[num].rule;
+    stats[num].matched = table->slots[num].matched;
+    stats[num].dropped = table->slots[num].dropped;
+  }
+  portEXIT_CRITICAL(&filter_mux);
+  return num;
+}
+
+void init_filter() {
+  filters_cfg_t config = get_filters_config();
+  filter_apply(&config);
+}
@@ -0,0 +1,20 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include "sink.h"
+#include "store.h"
+
+#define FILTER_TAG_BUCKETS 32
+
+typedef struct {
+  filter_rule_t rule;
+  uint32_t matched;
+  uint32_t dropped;
+} filter_stat_t;
+
+void init_filter();
+void filter_apply(const filters_cfg_t *config);
+bool filter_check(const log_data_t *frame);
+int filter_get_stats(filter_stat_t *stats, int max);
+
+#endif
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+#
+# Compresses a web asset for embedding. The gzip header mtime is zeroed so
+# the output, and the ETag derived from it, only change with the content.
+#
+import gzip
+import sys
+
+with open(sys.argv[1], 'rb') as src:
+    data = src.read()
+with open(sys.argv[2], 'wb') as dst:
+    gz = gzip.GzipFile(filename='', mode='wb', compresslevel=9, fileobj=dst, mtime=0)
+    gz.write(data)
+    gz.close()
@@ -0,0 +1,406 @@
+#include "history.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+
+// Lines are kept in a ring of fixed-size blocks. Each line is stored as
+//   level, varint ms since block start, tag byte,
+//   [tag length, tag] if the tag byte is TAG_NEW,
+//   [zigzag varint uptime delta] unless the tag byte is TAG_RAW,
+//   bytes of the message shared with the previous one at its start (0-255)
+//   and at its end (0-255), varint length of the rest, the rest
+// ESP-IDF lines "L (uptime) tag: message" are split up: the level is stored
+// once, the uptime as a delta from the previous line and the tag as an index
+// into the tags seen so far in the block, only the message is stored as
+// text. Other lines are stored whole as the message, with TAG_RAW. Every
+// block keeps its time range, a mask of the levels it holds and a bloom
+// filter of its words, so a search only decodes blocks that can match.
+typedef struct {
+  int64_t start_ms;
+  int64_t end_ms;
+  uint16_t len;
+  uint16_t count;
+  uint8_t levels;
+  uint8_t bloom[HISTORY_BLOOM_BITS / 8];
+  uint8_t data[HISTORY_BLOCK_SIZE];
+} history_block_t;
+
+#define TAG_RAW 0xff
+#define TAG_NEW 0xfe
+#define RECORD_MAX (1 + 5 + 1 + 1 + HISTORY_TAG_SIZE + 5 + 2 + 5 + LOG_LINE_SIZE)
+
+// What a block's records are coded against, rebuilt from the start of the
+// block by the decoder
+typedef struct {
+  char tags[HISTORY_TAGS_MAX][HISTORY_TAG_SIZE];
+  int tags_num;
+  uint32_t uptime;
+  char msg[LOG_LINE_SIZE];
+} history_codec_t;
+
+typedef struct {
+  bool parsed;
+  uint32_t uptime;
+  char tag[HISTORY_TAG_SIZE];
+  const char *msg;
+} history_header_t;
+
+static const char *TAG = "history";
+static history_block_t *blocks = NULL;
+static int blocks_num = 0;
+static int current = 0;
+static history_codec_t codec;
+static uint8_t record[RECORD_MAX];
+static SemaphoreHandle_t history_mutex = NULL;
+
+static int varint_put(uint8_t *out, uint32_t value) {
+  int len = 0;
+  do {
+    out[len] = value & 0x7f;
+    value >>= 7;
+    if (value) out[len] |= 0x80;
+    len++;
+  } while (value);
+  return len;
+}
+
+static int varint_get(const uint8_t *in, uint32_t *value) {
+  int len = 0;
+  *value = 0;
+  do {
+    *value |= (uint32_t)(in[len] & 0x7f) << (7 * len);
+  } while (in[len++] & 0x80 && len < 5);
+  return len;
+}
+
+static uint32_t zigzag(int32_t value) {
+  return ((uint32_t) value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// "L (uptime) tag: message", taken apart only if it prints back the same
+static void parse_header(const char *line, char level, history_header_t *hdr) {
+  const char *p = line + 3, *sep;
+  uint64_t uptime = 0;
+
+  hdr->parsed = false;
+  hdr->msg = line;
+  if (!level || line[0] != level || line[1] != ' ' || line[2] != '(') return;
+  if (!isdigit((unsigned char) *p) || (*p == '0' && isdigit((unsigned char) p[1]))) return;
+  while (isdigit((unsigned char) *p) && uptime <= UINT32_MAX) uptime = uptime * 10 + (*p++ - '0');
+  if (uptime > UINT32_MAX || p[0] != ')' || p[1] != ' ') return;
+  p += 2;
+  sep = strstr(p, ": ");
+  if (!sep || sep == p || sep - p >= HISTORY_TAG_SIZE) return;
+  memcpy(hdr->tag, p, sep - p);
+  hdr->tag[sep - p] = '\0';
+  hdr->uptime = uptime;
+  hdr->msg = sep + 2;
+  hdr->parsed = true;
+}
+
+static int codec_tag(const history_codec_t *c, const char *tag) {
+  for (int i = 0; i < c->tags_num; i++) {
+    if (!strcmp(c->tags[i], tag)) return i;
+  }
+  return -1;
+}
+
+static bool is_word_chr(char c) {
+  return isalnum((unsigned char) c) || c == '_';
+}
+
+// Calls cb with the FNV-1a hash of every lowercased word in str
+static int for_each_word(const char *str, void (*cb)(void *arg, uint32_t hash), void *arg) {
+  int words = 0;
+  while (*str) {
+    while (*str && !is_word_chr(*str)) str++;
+    if (!*str) break;
+    uint32_t hash = LOG_HASH_INIT;
+    while (is_word_chr(*str)) hash = log_hash_add(hash, (uint8_t) tolower((unsigned char) *str++));
+    cb(arg, hash);
+    words++;
+  }
+  return words;
+}
+
+static void bloom_add(void *arg, uint32_t hash) {
+  uint8_t *bloom = (uint8_t *) arg;
+  uint32_t step = (hash >> 17) | (hash << 15) | 1;
+  for (int i = 0; i < HISTORY_BLOOM_HASHES; i++) {
+    uint32_t bit = (hash + i * step) % HISTORY_BLOOM_BITS;
+    bloom[bit / 8] |= 1 << (bit % 8);
+  }
+}
+
+static bool bloom_test(const uint8_t *bloom, uint32_t hash) {
+  uint32_t step = (hash >> 17) | (hash << 15) | 1;
+  for (int i = 0; i < HISTORY_BLOOM_HASHES; i++) {
+    uint32_t bit = (hash + i * step) % HISTORY_BLOOM_BITS;
+    if (!(bloom[bit / 8] & (1 << (bit % 8)))) return false;
+  }
+  return true;
+}
+
+typedef struct {
+  uint32_t hashes[HISTORY_TERMS_MAX];
+  int num;
+} history_terms_t;
+
+static void term_add(void *arg, uint32_t hash) {
+  history_terms_t *terms = (history_terms_t *) arg;
+  if (terms->num < HISTORY_TERMS_MAX) terms->hashes[terms->num++] = hash;
+}
+
+typedef struct {
+  const history_terms_t *terms;
+  uint32_t found;
+} history_line_match_t;
+
+static void term_find(void *arg, uint32_t hash) {
+  history_line_match_t *match = (history_line_match_t *) arg;
+  for (int i = 0; i < match->terms->num; i++) {
+    if (match->terms->hashes[i] == hash) match->found |= 1 << i;
+  }
+}
+
+static void block_reset(history_block_t *block) {
+  memset(block, 0, offsetof(history_block_t, data));
+}
+
+static void codec_reset(history_codec_t *c) {
+  c->tags_num = 0;
+  c->uptime = 0;
+  c->msg[0] = '\0';
+}
+
+// The tag byte for the line: its index in the block, TAG_NEW or TAG_RAW
+static int header_tag(const history_header_t *hdr) {
+  int tag;
+  if (!hdr->parsed) return TAG_RAW;
+  tag = codec_tag(&codec, hdr->tag);
+  if (tag >= 0) return tag;
+  return codec.tags_num < HISTORY_TAGS_MAX ? TAG_NEW : TAG_RAW;
+}
+
+// Encodes into record against the codec without updating it, the caller
+// commits with codec_update() once the record fits in the block.
+static int encode_record(const log_data_t *frame, const history_header_t *hdr, int64_t start_ms, int64_t ts_ms) {
+  int tag = header_tag(hdr), len = 0, prefix = 0, suffix = 0;
+  const char *msg = tag == TAG_RAW ? frame->log_line : hdr->msg;
+  int msg_len = strlen(msg), prev_len = strlen(codec.msg);
+
+  record[len++] = frame->level;
+  len += varint_put(record + len, (uint32_t)(ts_ms - start_ms));
+  record[len++] = tag;
+  if (tag == TAG_NEW) {
+    record[len++] = strlen(hdr->tag);
+    len += sprintf((char *) record + len, "%s", hdr->tag);
+  }
+  if (tag != TAG_RAW) len += varint_put(record + len, zigzag((int32_t)(hdr->uptime - codec.uptime)));
+  while (prefix < 255 && prefix < msg_len && prefix < prev_len && msg[prefix] == codec.msg[prefix]) prefix++;
+  while (suffix < 255 && prefix + suffix < msg_len && prefix + suffix < prev_len &&
+         msg[msg_len - 1 - suffix] == codec.msg[prev_len - 1 - suffix]) suffix++;
+  record[len++] = prefix;
+  record[len++] = suffix;
+  len += varint_put(record + len, msg_len - prefix - suffix);
+  memcpy(record + len, msg + prefix, msg_len - prefix - suffix);
+  return len + msg_len - prefix - suffix;
+}
+
+static void codec_update(const log_data_t *frame, const history_header_t *hdr) {
+  int tag = header_tag(hdr);
+  if (tag == TAG_NEW) strcpy(codec.tags[codec.tags_num++], hdr->tag);
+  if (tag != TAG_RAW) codec.uptime = hdr->uptime;
+  strcpy(codec.msg, tag == TAG_RAW ? frame->log_line : hdr->msg);
+}
+
+// Decodes the record at p into line, returns NULL if it is corrupt
+static const uint8_t *decode_record(history_codec_t *c, const uint8_t *p, const uint8_t *end, char *level, uint32_t *dt, char *line) {
+  uint32_t delta, rest, prev_len;
+  uint8_t tag, prefix, suffix;
+
+  *level = *p++;
+  p += varint_get(p, dt);
+  tag = *p++;
+  if (tag == TAG_NEW) {
+    if (c->tags_num >= HISTORY_TAGS_MAX || *p >= HISTORY_TAG_SIZE || p + 1 + *p > end) return NULL;
+    memcpy(c->tags[c->tags_num], p + 1, *p);
+    c->tags[c->tags_num][*p] = '\0';
+    p += 1 + *p;
+    tag = c->tags_num++;
+  } else if (tag != TAG_RAW && tag >= c->tags_num) {
+    return NULL;
+  }
+  if (tag != TAG_RAW) {
+    p += varint_get(p, &delta);
+    c->uptime += unzigzag(delta);
+  }
+  prefix = *p++;
+  suffix = *p++;
+  p += varint_get(p, &rest);
+  prev_len = strlen(c->msg);
+  if (prefix + suffix > prev_len || prefix + rest + suffix >= LOG_LINE_SIZE || p + rest > end) return NULL;
+  // The message is rebuilt in place, its shared end moved behind the new part
+  memmove(c->msg + prefix + rest, c->msg + prev_len - suffix, suffix);
+  memcpy(c->msg + prefix, p, rest);
+  c->msg[prefix + rest + suffix] = '\0';
+  if (tag == TAG_RAW) strcpy(line, c->msg);
+  else snprintf(line, LOG_LINE_SIZE, "%c (%u) %s: %s", *level, c->uptime, c->tags[tag], c->msg);
+  return p + rest;
+}
+
+static esp_err_t history_write(sink_t *sink, const log_data_t *frame) {
+  int64_t ts_ms = (int64_t) frame->tv.tv_sec * 1000 + frame->tv.tv_usec / 1000;
+  history_header_t hdr;
+  history_block_t *block;
+  int len;
+
+  parse_header(frame->log_line, frame->level, &hdr);
+  xSemaphoreTake(history_mutex, portMAX_DELAY);
+  block = &blocks[current];
+  if (block->count && ts_ms >= block->start_ms && ts_ms - block->start_ms < UINT32_MAX) {
+    len = encode_record(frame, &hdr, block->start_ms, ts_ms);
+    if (block->len + len > HISTORY_BLOCK_SIZE) len = 0;
+  } else {
+    len = 0;
+  }
+  if (!len) {
+    // Seal the block and start overwriting the oldest one
+    if (block->count) {
+      current = (current + 1) % blocks_num;
+      block = &blocks[current];
+    }
+    block_reset(block);
+    codec_reset(&codec);
+    block->start_ms = ts_ms;
+    len = encode_record(frame, &hdr, ts_ms, ts_ms);
+  }
+  memcpy(block->data + block->len, record, len);
+  block->len += len;
+  block->count++;
+  if (ts_ms > block->end_ms) block->end_ms = ts_ms;
+  block->levels |= HISTORY_LEVEL(frame->level);
+  for_each_word(frame->log_line, bloom_add, block->bloom);
+  codec_update(frame, &hdr);
+  xSemaphoreGive(history_mutex);
+  return ESP_OK;
+}
+
+static esp_err_t history_flush(sink_t *sink) {
+  return ESP_OK;
+}
+
+static bool block_may_match(const history_block_t *block, const history_query_t *query, const history_terms_t *terms) {
+  if (!block->count || block->end_ms < query->since_ms) return false;
+  if (query->levels && !(block->levels & query->levels)) return false;
+  for (int i = 0; i < terms->num; i++) {
+    if (!bloom_test(block->bloom, terms->hashes[i])) return false;
+  }
+  return true;
+}
+
+// Copies one candidate block at a time under the lock and decodes it
+// unlocked, so ingestion only ever waits for a 4 KB memcpy.
+int history_search(const history_query_t *query, history_match_cb_t cb, void *arg) {
+  history_terms_t terms = { .num = 0 };
+  history_block_t *copy;
+  history_codec_t *dec;
+  char *line;
+  int matches = 0, scanned = 0;
+
+  if (!blocks) return 0;
+  copy = (history_block_t *) malloc(sizeof(history_block_t));
+  dec = (history_codec_t *) malloc(sizeof(history_codec_t));
+  line = (char *) malloc(LOG_LINE_SIZE);
+  if (!copy || !dec || !line) {
+    free(copy);
+    free(dec);
+    free(line);
+    return -1;
+  }
+  if (query->q) for_each_word(query->q, term_add, &terms);
+
+  xSemaphoreTake(history_mutex, portMAX_DELAY);
+  int idx = (current + 1) % blocks_num;
+  xSemaphoreGive(history_mutex);
+  for (int b = 0; b < blocks_num && (query->limit <= 0 || matches < query->limit); b++, idx = (idx + 1) % blocks_num) {
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    bool candidate = block_may_match(&blocks[idx], query, &terms);
+    if (candidate) memcpy(copy, &blocks[idx], sizeof(history_block_t));
+    xSemaphoreGive(history_mutex);
+    if (!candidate) continue;
+    scanned++;
+
+    const uint8_t *p = copy->data, *end = copy->data + copy->len;
+    codec_reset(dec);
+    while (p < end && (query->limit <= 0 || matches < query->limit)) {
+      uint32_t dt;
+      char level;
+      p = decode_record(dec, p, end, &level, &dt, line);
+      if (!p) break;
+
+      int64_t ts_ms = copy->start_ms + dt;
+      if (ts_ms < query->since_ms) continue;
+      if (query->levels && !(HISTORY_LEVEL(level) & query->levels)) continue;
+      if (terms.num) {
+        history_line_match_t match = { .terms = &terms, .found = 0 };
+        for_each_word(line, term_find, &match);
+        if (match.found != (1u << terms.num) - 1) continue;
+      }
+      cb(arg, ts_ms, level, line);
+      matches++;
+    }
+  }
+  ESP_LOGD(TAG, "%d matches, %d of %d blocks decoded", matches, scanned, blocks_num);
+  free(copy);
+  free(dec);
+  free(line);
+  return matches;
+}
+
+static const sink_ops_t history_sink_ops = {
+  .name = "history_sink",
+  .queue_size = 4096,
+  .flush_ms = 1000,
+  .stack_size = 3072,
+  .open = NULL,
+  .write = history_write,
+  .flush = history_flush,
+  .poll = NULL,
+};
+
+void init_history() {
+  size_t psram = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+
+  blocks_num = psram > HISTORY_PSRAM_RESERVE ? (psram - HISTORY_PSRAM_RESERVE) / sizeof(history_block_t) : 0;
+  if (blocks_num > HISTORY_PSRAM_BLOCKS) blocks_num = HISTORY_PSRAM_BLOCKS;
+  if (blocks_num >= 2) blocks = (history_block_t *) heap_caps_calloc(blocks_num, sizeof(history_block_t), MALLOC_CAP_SPIRAM);
+  if (!blocks) {
+    blocks_num = HISTORY_BLOCKS;
+    if (!blocks_num) {
+      ESP_LOGI(TAG, "no PSRAM, history disabled");
+      return;
+    }
+    blocks = (history_block_t *) calloc(blocks_num, sizeof(history_block_t));
+  }
+  history_mutex = xSemaphoreCreateMutex();
+  if (!history_mutex || !blocks) {
+    ESP_LOGE(TAG, "not enough memory for %d history blocks", blocks_num);
+    free(blocks);
+    blocks = NULL;
+    blocks_num = 0;
+    return;
+  }
+  ESP_LOGI(TAG, "keeping %d KB of history", blocks_num * HISTORY_BLOCK_SIZE / 1024);
+  if (sink_register(&history_sink_ops, NULL) != ESP_OK) ESP_LOGE(TAG, "failed to register history sink");
+}
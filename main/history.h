@@ -0,0 +1,42 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include "sink.h"
+
+// The ring takes up to HISTORY_PSRAM_BLOCKS from the largest free PSRAM
+// block, leaving HISTORY_PSRAM_RESERVE of it to others. Without PSRAM it
+// falls back to HISTORY_BLOCKS of internal RAM, 0 turns history off there.
+// With the ESP-IDF header coded apart from the message, a 66 byte sensor
+// line takes ~43 bytes: 512 PSRAM blocks (2 MB) keep ~48,000 lines, the 2
+// internal ones (8 KB) between ~95 and ~190 as the oldest is overwritten.
+#ifndef HISTORY_BLOCKS
+#define HISTORY_BLOCKS 2
+#endif
+#ifndef HISTORY_PSRAM_BLOCKS
+#define HISTORY_PSRAM_BLOCKS 512
+#endif
+#define HISTORY_PSRAM_RESERVE (128 * 1024)
+#define HISTORY_BLOCK_SIZE 4096
+#define HISTORY_BLOOM_BITS 1024
+#define HISTORY_BLOOM_HASHES 3
+#define HISTORY_TERMS_MAX 8
+#define HISTORY_TAGS_MAX 32 // per block, lines with further tags are stored whole
+#define HISTORY_TAG_SIZE 32
+
+// Terms in q are matched as whole words, case-insensitive, and all of them
+// must be present in a line. levels is a mask of HISTORY_LEVEL() bits, 0 = any.
+typedef struct {
+  const char *q;
+  int64_t since_ms;
+  uint8_t levels;
+  int limit;
+} history_query_t;
+
+#define HISTORY_LEVEL(level) (1 << log_level_idx(level))
+
+typedef void (*history_match_cb_t)(void *arg, int64_t ts_ms, char level, const char *line);
+
+void init_history();
+int history_search(const history_query_t *query, history_match_cb_t cb, void *arg);
+
+#endif
@@ -0,0 +1,90 @@
+#include "loadgen.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Roughly what a busy application prints: mostly info, some debug and the
+// odd warning or error, mostly short lines with a tail of long dumps. The
+// sizes span LOADGEN_MIN_LEN to LOADGEN_MAX_LEN.
+static const char level_mix[] = "IIIIIIIIIIIIIIDDDWWE";
+static const uint16_t size_mix[] = { 48, 48, 48, 64, 96, 96, 160, 320, 640, 960 };
+static const char *tags[] = { "wifi", "httpd", "app_main", "sensor", "mqtt_client", "nvs", "esp_netif", "ota" };
+
+static uint32_t xorshift32(loadgen_t *gen) {
+  uint32_t x = gen->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  gen->seed = x;
+  return x;
+}
+
+void loadgen_init(loadgen_t *gen, uint32_t seed, uint16_t min_len, uint16_t max_len) {
+  gen->seed = seed ? seed : 2463534242u;
+  gen->seq = 0;
+  gen->min_len = min_len ? min_len : LOADGEN_MIN_LEN;
+  gen->max_len = max_len ? max_len : LOADGEN_MAX_LEN;
+  if (gen->max_len < gen->min_len) gen->max_len = gen->min_len;
+}
+
+// Formats one line the way ESP_LOGx does, color codes included, so it takes
+// the same sanitizing path as real UART input. Returns its length.
+size_t loadgen_line(loadgen_t *gen, uint32_t uptime_ms, char *buf, size_t size) {
+  char level = level_mix[xorshift32(gen) % (sizeof(level_mix) - 1)];
+  size_t target = size_mix[xorshift32(gen) % (sizeof(size_mix) / sizeof(size_mix[0]))];
+  const char *tag = tags[xorshift32(gen) % (sizeof(tags) / sizeof(tags[0]))];
+  const char *color = level == 'E' ? "\033[0;31m" : level == 'W' ? "\033[0;33m" : level == 'I' ? "\033[0;32m" : "";
+  const char *reset = color[0] ? "\033[0m" : "";
+  int len;
+
+  target = gen->min_len + (target - LOADGEN_MIN_LEN) * (gen->max_len - gen->min_len) / (LOADGEN_MAX_LEN - LOADGEN_MIN_LEN);
+  if (target > size - 1 - strlen(reset)) target = size - 1 - strlen(reset);
+  len = snprintf(buf, size, "%s%c (%u) %s: seq=%u", color, level, uptime_ms, tag, gen->seq++);
+  if (len < 0) return 0;
+  if ((size_t) len >= size) len = size - 1;
+  // Random words keep the history bloom filters and prefix compression honest
+  while ((size_t) len + 10 <= target) len += sprintf(buf + len, " %08x", xorshift32(gen));
+  len += sprintf(buf + len, "%s", reset);
+  return len;
+}
+
+void loadgen_ramp_init(loadgen_ramp_t *ramp, const loadgen_limits_t *limits) {
+  memset(ramp, 0, sizeof(loadgen_ramp_t));
+  ramp->limits = *limits;
+  if (!ramp->limits.min_len) ramp->limits.min_len = LOADGEN_MIN_LEN;
+  if (!ramp->limits.max_len) ramp->limits.max_len = LOADGEN_MAX_LEN;
+  if (ramp->limits.max_len < ramp->limits.min_len) ramp->limits.max_len = ramp->limits.min_len;
+  if (ramp->limits.min_rate < 1) ramp->limits.min_rate = 1;
+  if (ramp->limits.max_rate < ramp->limits.min_rate) ramp->limits.max_rate = ramp->limits.min_rate;
+  ramp->rate = ramp->limits.min_rate;
+}
+
+// Grows the rate by half each step until a step goes over the limits, then
+// bisects between the best passing and the worst failing rate down to 10%.
+// Returns the rate for the next step, 0 when the search is over.
+uint32_t loadgen_ramp_step(loadgen_ramp_t *ramp, const loadgen_step_t *step) {
+  bool ok = step->dropped <= ramp->limits.max_drops && step->p95_ms <= ramp->limits.max_latency_ms;
+
+  ramp->steps++;
+  if (ok && step->rate > ramp->pass_rate) {
+    ramp->pass_rate = step->rate;
+    ramp->lines_per_s = step->elapsed_ms ? (uint64_t) step->lines * 1000 / step->elapsed_ms : 0;
+    ramp->bytes_per_s = step->elapsed_ms ? (uint64_t) step->bytes * 1000 / step->elapsed_ms : 0;
+    ramp->p50_ms = step->p50_ms;
+    ramp->p95_ms = step->p95_ms;
+    ramp->p99_ms = step->p99_ms;
+  } else if (!ok && (!ramp->fail_rate || step->rate < ramp->fail_rate)) {
+    ramp->fail_rate = step->rate;
+  }
+
+  if (!ramp->fail_rate) {
+    if (step->rate >= ramp->limits.max_rate) ramp->rate = 0;
+    else ramp->rate = step->rate + (step->rate / 2 ? step->rate / 2 : 1);
+    if (ramp->rate > ramp->limits.max_rate) ramp->rate = ramp->limits.max_rate;
+  } else if (ramp->fail_rate <= ramp->limits.min_rate || ramp->fail_rate - ramp->pass_rate <= ramp->fail_rate / 10 + 1) {
+    ramp->rate = 0;
+  } else {
+    ramp->rate = ramp->pass_rate + (ramp->fail_rate - ramp->pass_rate) / 2;
+  }
+  return ramp->rate;
+}
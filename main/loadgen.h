@@ -0,0 +1,66 @@
+#ifndef __LOADGEN_H__
+#define __LOADGEN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic ESP-IDF lines and the ramp that searches for the highest rate
+// the device sustains. Plain C with no ESP-IDF or FreeRTOS dependency, so it
+// builds on the host too; loadtest.c drives it on the device.
+
+// Range of the default size mix, line lengths with the ESP-IDF header
+#define LOADGEN_MIN_LEN 48
+#define LOADGEN_MAX_LEN 960
+
+typedef struct {
+  uint32_t seed;
+  uint32_t seq;
+  uint16_t min_len;
+  uint16_t max_len;
+} loadgen_t;
+
+typedef struct {
+  uint32_t min_rate; // lines/s
+  uint32_t max_rate;
+  uint32_t max_latency_ms; // p95 delivery latency
+  uint32_t max_drops; // per step
+  // The size mix is scaled onto [min_len, max_len], lines never get shorter
+  // than their header. 0 keeps the default range.
+  uint16_t min_len;
+  uint16_t max_len;
+} loadgen_limits_t;
+
+// What happened during one step at a fixed rate
+typedef struct {
+  uint32_t rate;
+  uint32_t lines;
+  uint32_t bytes;
+  uint32_t dropped;
+  uint32_t elapsed_ms;
+  // Delivery latency of the step's lines, measured by the caller
+  uint32_t p50_ms;
+  uint32_t p95_ms;
+  uint32_t p99_ms;
+} loadgen_step_t;
+
+typedef struct {
+  loadgen_limits_t limits;
+  uint32_t rate; // rate for the next step, 0 once the search is over
+  uint32_t pass_rate; // highest rate within limits
+  uint32_t fail_rate; // lowest rate over them, 0 if none yet
+  // Measured in the pass_rate step
+  uint32_t lines_per_s;
+  uint32_t bytes_per_s;
+  uint32_t p50_ms;
+  uint32_t p95_ms;
+  uint32_t p99_ms;
+  int steps;
+} loadgen_ramp_t;
+
+void loadgen_init(loadgen_t *gen, uint32_t seed, uint16_t min_len, uint16_t max_len);
+size_t loadgen_line(loadgen_t *gen, uint32_t uptime_ms, char *buf, size_t size);
+void loadgen_ramp_init(loadgen_ramp_t *ramp, const loadgen_limits_t *limits);
+uint32_t loadgen_ramp_step(loadgen_ramp_t *ramp, const loadgen_step_t *step);
+
+#endif
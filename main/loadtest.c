@@ -0,0 +1,160 @@
+#include "loadtest.h"
+#include "serial.h"
+#include "sink.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+typedef struct {
+  uint32_t lost; // dropped on a full queue or failed to send
+  uint32_t latency_hist[SINKS_MAX][SINK_HIST_BUCKETS];
+} loadtest_snapshot_t;
+
+static const char *TAG = "loadtest";
+static portMUX_TYPE loadtest_mux = portMUX_INITIALIZER_UNLOCKED;
+static loadtest_status_t status = { .state = LOADTEST_IDLE, .slowest = "" };
+static volatile bool stop_requested = false;
+
+static void take_snapshot(loadtest_snapshot_t *snap) {
+  memset(snap, 0, sizeof(loadtest_snapshot_t));
+  for (int i = 0; i < sink_count(); i++) {
+    const sink_t *sink = sink_get(i);
+    snap->lost += sink->dropped + sink->failed;
+    memcpy(snap->latency_hist[i], sink->latency_hist, sizeof(sink->latency_hist));
+  }
+}
+
+// Fills in the step's losses and the delivery latency of its slowest sink
+static const char *step_result(loadgen_step_t *step, const loadtest_snapshot_t *before, const loadtest_snapshot_t *after) {
+  uint32_t hist[SINK_HIST_BUCKETS], p95, worst = 0;
+  const char *slowest = "";
+
+  step->dropped = after->lost - before->lost;
+  for (int i = 0; i < sink_count(); i++) {
+    for (int b = 0; b < SINK_HIST_BUCKETS; b++) hist[b] = after->latency_hist[i][b] - before->latency_hist[i][b];
+    p95 = sink_hist_percentile(hist, 95);
+    if (!slowest[0] || p95 > worst) {
+      worst = p95;
+      slowest = sink_get(i)->ops->name;
+      step->p50_ms = sink_hist_percentile(hist, 50);
+      step->p95_ms = p95;
+      step->p99_ms = sink_hist_percentile(hist, 99);
+    }
+  }
+  return slowest;
+}
+
+// Feeds generated lines through the same path as the UART, paced per tick,
+// one step per rate the ramp asks for. Real UART input keeps flowing and
+// counts towards the load.
+static void loadtest_task(void *arg) {
+  serial_parser_t *parser = (serial_parser_t *) malloc(sizeof(serial_parser_t));
+  char *line = (char *) malloc(LOG_LINE_SIZE);
+  loadtest_snapshot_t before, after;
+  loadgen_step_t step;
+  loadgen_t gen;
+  TickType_t start, now;
+  uint32_t rate, due;
+  const char *slowest;
+
+  if (!parser || !line) {
+    ESP_LOGE(TAG, "not enough memory to run");
+    stop_requested = true;
+  }
+  loadgen_init(&gen, esp_random(), status.ramp.limits.min_len, status.ramp.limits.max_len);
+  while (!stop_requested) {
+    portENTER_CRITICAL(&loadtest_mux);
+    rate = status.ramp.rate;
+    status.rate = rate;
+    portEXIT_CRITICAL(&loadtest_mux);
+    if (!rate) break;
+
+    memset(&step, 0, sizeof(loadgen_step_t));
+    step.rate = rate;
+    take_snapshot(&before);
+    start = now = xTaskGetTickCount();
+    while (!stop_requested && (now - start) * portTICK_PERIOD_MS < LOADTEST_STEP_MS) {
+      vTaskDelay(1);
+      now = xTaskGetTickCount();
+      due = (uint64_t) rate * ((now - start) * portTICK_PERIOD_MS) / 1000;
+      memset(&parser->out_line, 0, sizeof(log_data_t));
+      gettimeofday(&parser->out_line.tv, NULL);
+      while (step.lines < due) {
+        step.bytes += loadgen_line(&gen, now * portTICK_PERIOD_MS, line, LOG_LINE_SIZE);
+        serial_feed_line(parser, line);
+        step.lines++;
+      }
+    }
+    step.elapsed_ms = (now - start) * portTICK_PERIOD_MS;
+    vTaskDelay(pdMS_TO_TICKS(LOADTEST_SETTLE_MS));
+    if (stop_requested) break;
+
+    take_snapshot(&after);
+    slowest = step_result(&step, &before, &after);
+    portENTER_CRITICAL(&loadtest_mux);
+    loadgen_ramp_step(&status.ramp, &step);
+    status.last_dropped = step.dropped;
+    status.last_p95_ms = step.p95_ms;
+    status.slowest = slowest;
+    portEXIT_CRITICAL(&loadtest_mux);
+    ESP_LOGI(TAG, "%u lines/s: %u lost, p95 %u ms (%s)", rate, step.dropped, status.last_p95_ms, slowest);
+  }
+
+  portENTER_CRITICAL(&loadtest_mux);
+  status.state = stop_requested ? LOADTEST_STOPPED : LOADTEST_DONE;
+  status.rate = 0;
+  portEXIT_CRITICAL(&loadtest_mux);
+  ESP_LOGI(TAG, "sustained %u lines/s, %u bytes/s, delivery latency p50 %u p95 %u p99 %u ms",
+           status.ramp.lines_per_s, status.ramp.bytes_per_s, status.ramp.p50_ms, status.ramp.p95_ms, status.ramp.p99_ms);
+  free(parser);
+  free(line);
+  vTaskDelete(NULL);
+}
+
+esp_err_t loadtest_start(const loadgen_limits_t *limits) {
+  const loadgen_limits_t defaults = {
+    .min_rate = LOADTEST_MIN_RATE,
+    .max_rate = LOADTEST_MAX_RATE,
+    .max_latency_ms = LOADTEST_MAX_LATENCY_MS,
+    .max_drops = 0,
+  };
+
+  portENTER_CRITICAL(&loadtest_mux);
+  if (status.state == LOADTEST_RUNNING) {
+    portEXIT_CRITICAL(&loadtest_mux);
+    return ESP_ERR_INVALID_STATE;
+  }
+  status.state = LOADTEST_RUNNING;
+  loadgen_ramp_init(&status.ramp, limits ? limits : &defaults);
+  status.last_dropped = 0;
+  status.last_p95_ms = 0;
+  status.slowest = "";
+  portEXIT_CRITICAL(&loadtest_mux);
+
+  stop_requested = false;
+  // Same priority as uart_event_task, the generator stands in for it
+  if (xTaskCreate(loadtest_task, "loadtest_task", 4096, NULL, 12, NULL) != pdPASS) {
+    status.state = LOADTEST_IDLE;
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_LOGI(TAG, "started, %u to %u lines/s of %u to %u bytes", status.ramp.limits.min_rate, status.ramp.limits.max_rate,
+           status.ramp.limits.min_len, status.ramp.limits.max_len);
+  return ESP_OK;
+}
+
+void loadtest_stop() {
+  stop_requested = true;
+}
+
+loadtest_status_t loadtest_get_status() {
+  loadtest_status_t copy;
+  portENTER_CRITICAL(&loadtest_mux);
+  copy = status;
+  portEXIT_CRITICAL(&loadtest_mux);
+  return copy;
+}
@@ -0,0 +1,40 @@
+#ifndef __LOADTEST_H__
+#define __LOADTEST_H__
+
+#include "esp_err.h"
+
+#include "loadgen.h"
+
+// With LOADTEST_ON_BOOT a load test with the default limits starts as soon
+// as the sinks are up, otherwise it is started from the web UI.
+#ifndef LOADTEST_ON_BOOT
+#define LOADTEST_ON_BOOT 0
+#endif
+#define LOADTEST_STEP_MS 5000
+#define LOADTEST_SETTLE_MS 3000 // after each step, lets the sinks drain
+#define LOADTEST_MIN_RATE 50
+#define LOADTEST_MAX_RATE 20000
+// p95 from reception to delivery, includes the sinks' batching (2 s for Loki)
+#define LOADTEST_MAX_LATENCY_MS 5000
+
+typedef enum {
+  LOADTEST_IDLE = 0,
+  LOADTEST_RUNNING,
+  LOADTEST_DONE,
+  LOADTEST_STOPPED,
+} loadtest_state_t;
+
+typedef struct {
+  loadtest_state_t state;
+  loadgen_ramp_t ramp;
+  uint32_t rate; // of the step in progress
+  uint32_t last_dropped; // in the last finished step
+  uint32_t last_p95_ms;
+  const char *slowest; // sink with the highest p95 in the last step
+} loadtest_status_t;
+
+esp_err_t loadtest_start(const loadgen_limits_t *limits);
+void loadtest_stop();
+loadtest_status_t loadtest_get_status();
+
+#endif
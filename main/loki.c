@@ -7,20 +7,83 @@
 #include "esp_log.h"
 #include "esp_system.h"
 
+#include <stdarg.h>
 #include <string.h>
-#include <time.h>
+
+// Frames are packed into a batch as records and only turned into JSON when
+// the batch is pushed, so a failed batch is cheap to keep and to split.
+typedef struct {
+  time_t sec;
+  long nsec;
+  uint16_t len; // whole record, header and padding included
+  uint8_t labels_len; // "key\0value\0" pairs following the header
+  char level;
+} loki_record_t;
+
+typedef struct loki_batch {
+  struct loki_batch *next;
+  size_t len;
+  size_t json_len;
+  int count;
+  int attempts;
+  int splits;
+  TickType_t retry_at;
+  char data[];
+} loki_batch_t;
+
+// Where the encoder writes to: the whole body in buffered mode, or a staging
+// buffer that is sent as a chunk every time it fills up in streaming mode.
+typedef struct {
+  esp_http_client_handle_t client;
+  char *buff;
+  size_t size;
+  size_t len;
+  bool failed;
+} loki_out_t;
+
+typedef enum {
+  LOKI_PUSH_OK = 0,
+  LOKI_PUSH_RETRY, // transport error, 429 or 5xx
+  LOKI_PUSH_SPLIT, // 400 or 413, a bad line or a too big body
+  LOKI_PUSH_REJECT, // any other status, retrying won't help
+} loki_push_t;
+
+typedef struct {
+  loki_endpoint_stat_t stat;
+  TickType_t down_until;
+} loki_endpoint_t;
+
+#define RECORD_ALIGN(x) (((x) + 7) & ~7)
+#define RECORD_LABELS(rec) ((const char *)(rec) + sizeof(loki_record_t))
+#define RECORD_LINE(rec) (RECORD_LABELS(rec) + (rec)->labels_len)
+#define ENTRY_OVERHEAD 160
 
 static const char *TAG = "loki";
 static const char *stream_header = "{\"stream\": {\"emitter\": \"" EMITTER_LABEL "\", \"job\": \"" JOB_LABEL "\"";
 static const char *stream_values_header = "}, \"values\":[[";
 // static const char *stream_values_delimiter = "\"], [";
 static const char *stream_footer = "\"]]}";
-const TickType_t xTicksToWait = pdMS_TO_TICKS(100);
-static log_data_t in_frame;
+#if LOKI_STREAMING
+static char post_buff[LOKI_STREAM_BUFF_SIZE + 2]; // room for the chunk's CRLF
+#else
 static char post_buff[JSON_BUFF_SIZE];
-static char entry_buff[ENTRY_BUFF_SIZE];
-
-QueueHandle_t data0_queue;
+#endif
+static char err_buff[ENTRY_BUFF_SIZE];
+static char mac_id[13] = "";
+static loki_cfg_t loki_config;
+static esp_http_client_config_t http_config;
+static unsigned int log_time_shift = 0;
+static unsigned long int prev_log_usec = 0;
+static unsigned long int new_log_usec = 0;
+static loki_batch_t *pending = NULL;
+static loki_batch_t *retry_head = NULL;
+static loki_batch_t *retry_tail = NULL;
+static size_t retry_bytes = 0;
+static int retry_num = 0;
+static loki_endpoint_t endpoints[LOKI_ENDPOINTS_MAX];
+static int endpoints_num = 0;
+static int endpoint_next = 0;
+static portMUX_TYPE endpoints_mux = portMUX_INITIALIZER_UNLOCKED;
 
 esp_err_t _http_event_handle(esp_http_client_event_t *evt) {
   switch(evt->event_id) {
@@ -50,116 +113,514 @@ esp_err_t _http_event_handle(esp_http_client_event_t *evt) {
   return ESP_OK;
 }
 
-void send_data(char *post_buff, esp_http_client_config_t *http_config) {
-  int len, read_len, status = 0;
-  
-  ESP_LOGD(TAG, "POST body: %s", post_buff);
-  
-  esp_http_client_handle_t client = esp_http_client_init(http_config);
+static size_t json_escape_len(const char *in) {
+  size_t len = 0;
+  for (; *in; in++) len += (*in == '"' || *in == '\\') ? 2 : 1;
+  return len;
+}
+
+static void out_flush(loki_out_t *out) {
+#if LOKI_STREAMING
+  char chunk_header[12];
+  int header_len;
+  if (out->failed || !out->len) return;
+  ESP_LOGD(TAG, "POST chunk: %.*s", (int) out->len, out->buff);
+  header_len = sprintf(chunk_header, "%x\r\n", (unsigned int) out->len);
+  memcpy(out->buff + out->len, "\r\n", 2);
+  if (esp_http_client_write(out->client, chunk_header, header_len) != header_len ||
+      esp_http_client_write(out->client, out->buff, out->len + 2) != out->len + 2) {
+    out->failed = true;
+  }
+  out->len = 0;
+#endif
+}
+
+static void out_put(loki_out_t *out, const char *data, size_t len) {
+  while (len && !out->failed) {
+    if (out->len == out->size) {
+      out_flush(out);
+      // Buffered mode can't make room, json_len accounting should prevent this
+      if (out->len == out->size) out->failed = true;
+      continue;
+    }
+    size_t n = out->size - out->len < len ? out->size - out->len : len;
+    memcpy(out->buff + out->len, data, n);
+    out->len += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static void out_puts(loki_out_t *out, const char *str) {
+  out_put(out, str, strlen(str));
+}
+
+static void out_printf(loki_out_t *out, const char *fmt, ...) {
+  char tmp[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(tmp, sizeof(tmp), fmt, args);
+  va_end(args);
+  out_put(out, tmp, len < sizeof(tmp) ? len : sizeof(tmp) - 1);
+}
+
+static void out_json_escape(loki_out_t *out, const char *in) {
+  const char *run = in;
+  for (; *in; in++) {
+    if (*in != '"' && *in != '\\' && (uint8_t) *in >= ' ') continue;
+    out_put(out, run, in - run);
+    if (*in == '"') out_put(out, "\\\"", 2);
+    else if (*in == '\\') out_put(out, "\\\\", 2);
+    else out_put(out, " ", 1);
+    run = in + 1;
+  }
+  out_put(out, run, in - run);
+}
+
+static void batch_reset(loki_batch_t *batch) {
+  batch->next = NULL;
+  batch->len = 0;
+  batch->json_len = 0;
+  batch->count = 0;
+  batch->attempts = 0;
+  batch->splits = 0;
+}
+
+// -- Make POST body
+// {
+//   "streams": [
+//     {
+//       "stream": {
+//         "label": "value"
+//       },
+//       "values": [
+//           [ "<unix epoch in nanoseconds>", "<log line>" ],
+//           [ "<unix epoch in nanoseconds>", "<log line>" ]
+//       ]
+//     }
+//   ]
+// }
+static void encode_batch(const loki_batch_t *batch, loki_out_t *out) {
+  const char *data = batch->data;
+  out_puts(out, "{\"streams\": [");
+
+  for (int i = 0; i < batch->count && !out->failed; i++) {
+    const loki_record_t *rec = (const loki_record_t *) data;
+    const char *label = RECORD_LABELS(rec);
+    if (i) out_puts(out, ", ");
+    out_puts(out, stream_header);
+    out_printf(out, ", \"hwid\": \"%s\", \"iname\": \"%s\"", mac_id, loki_config.name);
+    while (label < RECORD_LINE(rec)) {
+      const char *value = label + strlen(label) + 1;
+      out_printf(out, ", \"%s\": \"%s\"", label, value);
+      label = value + strlen(value) + 1;
+    }
+    out_puts(out, stream_values_header);
+    out_printf(out, "\"%ld%09ld\", \"", (long) rec->sec, rec->nsec);
+    out_json_escape(out, RECORD_LINE(rec));
+    out_puts(out, stream_footer);
+    data += rec->len;
+  }
+  out_puts(out, "]}");
+}
+
+static loki_push_t push_batch(loki_endpoint_t *ep, const loki_batch_t *batch) {
+  int read_len, status = 0;
+  loki_out_t out = { .buff = post_buff, .size = sizeof(post_buff), .len = 0, .failed = false };
+
+  http_config.host = ep->stat.cfg.host;
+  http_config.port = ep->stat.cfg.port;
+  esp_http_client_handle_t client = esp_http_client_init(&http_config);
+  if (!client) return LOKI_PUSH_RETRY;
   esp_http_client_set_header(client, "Content-Type", "application/json");
-  len = strlen(post_buff);
-  esp_http_client_open(client, len);
-  esp_http_client_write(client, post_buff, len);
-  len = esp_http_client_fetch_headers(client);
+  out.client = client;
+#if LOKI_STREAMING
+  out.size = LOKI_STREAM_BUFF_SIZE;
+  // A negative length makes the client send Transfer-Encoding: chunked
+  if (esp_http_client_open(client, -1) == ESP_OK) {
+    encode_batch(batch, &out);
+    out_flush(&out);
+    if (!out.failed && esp_http_client_write(client, "0\r\n\r\n", 5) != 5) out.failed = true;
+  } else {
+    out.failed = true;
+  }
+#else
+  encode_batch(batch, &out);
+  ESP_LOGD(TAG, "POST body: %.*s", (int) out.len, post_buff);
+  if (!out.failed && esp_http_client_open(client, out.len) == ESP_OK) {
+    if (esp_http_client_write(client, post_buff, out.len) != out.len) out.failed = true;
+  } else {
+    out.failed = true;
+  }
+#endif
+  if (out.failed) {
+    ESP_LOGW(TAG, "failed to send %d entries to %s:%d", batch->count, http_config.host, http_config.port);
+    esp_http_client_cleanup(client);
+    return LOKI_PUSH_RETRY;
+  }
+  if (esp_http_client_fetch_headers(client) < 0) {
+    ESP_LOGW(TAG, "no response for %d entries from %s:%d", batch->count, http_config.host, http_config.port);
+    esp_http_client_cleanup(client);
+    return LOKI_PUSH_RETRY;
+  }
   status = esp_http_client_get_status_code(client);
   if (status != 204) {
-    ESP_LOGW(TAG, "POST body: %s", post_buff);
-    read_len = esp_http_client_read(client, post_buff, len);
-    post_buff[read_len] = '\0';
-    ESP_LOGE(TAG, "%d: %s", status, read_len > 0 ? post_buff:"error");
+    read_len = esp_http_client_read(client, err_buff, sizeof(err_buff) - 1);
+    err_buff[read_len > 0 ? read_len : 0] = '\0';
+    ESP_LOGE(TAG, "%s:%d %d: %s", http_config.host, http_config.port, status, read_len > 0 ? err_buff:"error");
   } else {
     ESP_LOGD(TAG, "Status = %d", status);
   }
   esp_http_client_cleanup(client);
+
+  if (status >= 200 && status < 300) return LOKI_PUSH_OK;
+  if (status == 429 || status >= 500) return LOKI_PUSH_RETRY;
+  if (status == 400 || status == 413) return LOKI_PUSH_SPLIT;
+  return LOKI_PUSH_REJECT;
+}
+
+// Exponential backoff, randomized over the upper half of the interval so
+// devices that lost the endpoint together don't retry in lockstep.
+static TickType_t backoff_ticks(int attempt) {
+  uint32_t ms = LOKI_BACKOFF_MIN_MS;
+  while (--attempt > 0 && ms < LOKI_BACKOFF_MAX_MS) ms *= 2;
+  if (ms > LOKI_BACKOFF_MAX_MS) ms = LOKI_BACKOFF_MAX_MS;
+  ms = ms / 2 + esp_random() % (ms / 2 + 1);
+  return pdMS_TO_TICKS(ms);
+}
+
+// A failed endpoint cools down for a backoff interval and then gets one
+// batch to prove itself, so a flaky endpoint recovers without a separate
+// probe. While cooling it is only used when no other endpoint is left.
+static bool endpoint_cooling(const loki_endpoint_t *ep, TickType_t now) {
+  return ep->stat.failures && (int32_t)(ep->down_until - now) > 0;
+}
+
+// After LOKI_BREAKER_THRESHOLD consecutive failures the circuit opens and
+// the endpoint is not tried at all until it has cooled down.
+static bool endpoint_open(const loki_endpoint_t *ep, TickType_t now) {
+  return ep->stat.failures >= LOKI_BREAKER_THRESHOLD && endpoint_cooling(ep, now);
+}
+
+// True while no endpoint may be tried
+static bool breaker_open(TickType_t now) {
+  for (int i = 0; i < endpoints_num; i++) {
+    if (!endpoint_open(&endpoints[i], now)) return false;
+  }
+  return true;
+}
+
+// Failover mode takes the endpoint with the lowest latency, ties go to the
+// one listed first. An endpoint that hasn't answered yet has latency 0 and
+// counts as unknown, never as faster, so batches stay on the first healthy
+// endpoint. Spread mode takes the next endpoint in turn. Either way a
+// cooling endpoint is only taken when no other one is left.
+static loki_endpoint_t *endpoint_pick(TickType_t now, uint32_t tried) {
+  loki_endpoint_t *best = NULL;
+  bool best_cooling = false, cooling;
+  for (int n = 0; n < endpoints_num; n++) {
+    int i = loki_config.mode == LOKI_MODE_SPREAD ? (endpoint_next + n) % endpoints_num : n;
+    loki_endpoint_t *ep = &endpoints[i];
+    if (tried & (1 << i) || endpoint_open(ep, now)) continue;
+    cooling = endpoint_cooling(ep, now);
+    if (best && (cooling > best_cooling || (cooling == best_cooling && loki_config.mode == LOKI_MODE_SPREAD))) continue;
+    if (best && cooling == best_cooling &&
+        !(ep->stat.latency_ms && best->stat.latency_ms && ep->stat.latency_ms < best->stat.latency_ms)) continue;
+    best = ep;
+    best_cooling = cooling;
+  }
+  return best;
+}
+
+static void endpoint_record(loki_endpoint_t *ep, loki_push_t result, TickType_t elapsed, int count) {
+  TickType_t cooldown = 0;
+  uint32_t ms = elapsed * portTICK_PERIOD_MS;
+  int failures;
+
+  if (result == LOKI_PUSH_RETRY) cooldown = backoff_ticks(ep->stat.failures + 1);
+  portENTER_CRITICAL(&endpoints_mux);
+  failures = ep->stat.failures;
+  ep->stat.pushes++;
+  if (result == LOKI_PUSH_RETRY) {
+    ep->stat.errors++;
+    ep->stat.failures++;
+    ep->down_until = xTaskGetTickCount() + cooldown;
+  } else {
+    // Any answer but a 5xx means the endpoint is alive
+    ep->stat.failures = 0;
+    if (!ms) ms = 1; // 0 means not measured yet
+    if (ep->stat.latency_ms) ep->stat.latency_ms += ((int32_t) ms - (int32_t) ep->stat.latency_ms) / LOKI_LATENCY_WEIGHT;
+    else ep->stat.latency_ms = ms;
+    if (result == LOKI_PUSH_OK) ep->stat.sent += count;
+  }
+  portEXIT_CRITICAL(&endpoints_mux);
+
+  if (result != LOKI_PUSH_RETRY) {
+    if (failures >= LOKI_BREAKER_THRESHOLD) ESP_LOGI(TAG, "%s:%d is back, circuit closed", ep->stat.cfg.host, ep->stat.cfg.port);
+  } else if (failures + 1 >= LOKI_BREAKER_THRESHOLD) {
+    ESP_LOGW(TAG, "%s:%d down, circuit open for %u ms", ep->stat.cfg.host, ep->stat.cfg.port, cooldown * portTICK_PERIOD_MS);
+  }
+}
+
+// Fails over to the remaining endpoints on a transport error, 429 or 5xx,
+// so a dead endpoint costs the batch one timeout instead of a retry interval.
+// Other answers are about the batch itself and are final.
+static loki_push_t push_any(const loki_batch_t *batch) {
+  loki_push_t result = LOKI_PUSH_RETRY;
+  loki_endpoint_t *ep;
+  uint32_t tried = 0;
+  TickType_t start;
+
+  while ((ep = endpoint_pick(xTaskGetTickCount(), tried)) != NULL) {
+    int idx = ep - endpoints;
+    if (!tried) endpoint_next = (idx + 1) % endpoints_num;
+    tried |= 1 << idx;
+    start = xTaskGetTickCount();
+    result = push_batch(ep, batch);
+    endpoint_record(ep, result, xTaskGetTickCount() - start, batch->count);
+    if (result != LOKI_PUSH_RETRY) break;
+  }
+  return result;
+}
+
+static void retry_drop(sink_t *sink, loki_batch_t *batch, const char *reason) {
+  ESP_LOGW(TAG, "dropping %d entries: %s", batch->count, reason);
+  sink->failed += batch->count;
+  free(batch);
+}
+
+static loki_batch_t *retry_pop() {
+  loki_batch_t *batch = retry_head;
+  if (!batch) return NULL;
+  retry_head = batch->next;
+  if (!retry_head) retry_tail = NULL;
+  retry_bytes -= batch->len;
+  retry_num--;
+  batch->next = NULL;
+  return batch;
+}
+
+static void retry_push_front(loki_batch_t *batch) {
+  batch->next = retry_head;
+  retry_head = batch;
+  if (!retry_tail) retry_tail = batch;
+  retry_bytes += batch->len;
+  retry_num++;
 }
 
-void send_data_task(void *arg) {
-  unsigned int log_line_cnt = 0;
-  unsigned int log_time_shift = 0;
-  unsigned long int prev_log_usec = 0;
-  unsigned long int new_log_usec = 0;
-  time_t now, prev_now;
-  BaseType_t xStatus;
-  char mac_id[13] = "";
+static void retry_append(loki_batch_t *batch) {
+  batch->next = NULL;
+  if (retry_tail) retry_tail->next = batch;
+  else retry_head = batch;
+  retry_tail = batch;
+  retry_bytes += batch->len;
+  retry_num++;
+}
+
+// Copies count records starting at data into a new batch for the retry list,
+// evicting the oldest retries while the list is over its bounds.
+static loki_batch_t *retry_keep(sink_t *sink, const char *data, size_t len, int count, int attempts, int splits) {
+  loki_batch_t *batch;
+  if (len > LOKI_RETRY_BYTES) return NULL;
+  while (retry_head && (retry_bytes + len > LOKI_RETRY_BYTES || retry_num >= LOKI_RETRY_MAX)) {
+    retry_drop(sink, retry_pop(), "retry list full");
+  }
+  batch = (loki_batch_t *) malloc(sizeof(loki_batch_t) + len);
+  if (!batch) return NULL;
+  batch_reset(batch);
+  memcpy(batch->data, data, len);
+  batch->len = len;
+  batch->count = count;
+  batch->attempts = attempts;
+  batch->splits = splits;
+  batch->retry_at = xTaskGetTickCount();
+  return batch;
+}
+
+// Handles the outcome of a push. A kept batch is owned by the retry list and
+// accounted here, otherwise the caller accounts for ESP_OK and ESP_FAIL.
+static esp_err_t handle_push(sink_t *sink, loki_batch_t *batch, loki_push_t result, bool kept) {
+  TickType_t now = xTaskGetTickCount();
+  loki_batch_t *retry, *half;
+  const loki_record_t *first = (const loki_record_t *) batch->data;
+  const char *mid, *reason = "rejected by endpoint";
+  struct timeval since;
+
+  switch(result) {
+    case LOKI_PUSH_OK:
+      if (!kept) return ESP_OK;
+      since.tv_sec = first->sec;
+      since.tv_usec = first->nsec / 1000;
+      sink_record_latency(sink, &since, batch->count);
+      sink->sent += batch->count;
+      free(batch);
+      return ESP_OK;
+    case LOKI_PUSH_RETRY:
+      reason = "out of retries";
+      if (batch->attempts + 1 >= LOKI_RETRY_ATTEMPTS) break;
+      retry = kept ? batch : retry_keep(sink, batch->data, batch->len, batch->count, batch->attempts, batch->splits);
+      reason = "no room to keep for a retry";
+      if (!retry) break;
+      retry->attempts++;
+      retry->retry_at = now + backoff_ticks(retry->attempts);
+      retry_push_front(retry);
+      return SINK_ERR_DEFERRED;
+    case LOKI_PUSH_SPLIT:
+      // Retry both halves right away so a bad line takes only its part of the
+      // batch down. The depth is capped: when Loki rejects the whole batch
+      // (entries too old, say) splitting down to single lines would cost
+      // 2N-1 pushes.
+      if (batch->count < 2) break;
+      reason = "rejected by endpoint, split limit reached";
+      if (batch->splits >= LOKI_SPLIT_DEPTH) break;
+      mid = batch->data;
+      for (int i = 0; i < batch->count / 2; i++) mid += ((const loki_record_t *) mid)->len;
+      half = retry_keep(sink, mid, batch->len - (mid - batch->data), batch->count - batch->count / 2, batch->attempts, batch->splits + 1);
+      retry = retry_keep(sink, batch->data, mid - batch->data, batch->count / 2, batch->attempts, batch->splits + 1);
+      if (!half || !retry) {
+        free(half);
+        free(retry);
+        reason = "no room to keep for a retry";
+        break;
+      }
+      retry_push_front(half);
+      retry_push_front(retry);
+      if (kept) free(batch);
+      return SINK_ERR_DEFERRED;
+    default:
+      break;
+  }
+  if (kept) retry_drop(sink, batch, reason);
+  else ESP_LOGW(TAG, "dropping %d entries: %s", batch->count, reason);
+  return ESP_FAIL;
+}
+
+static esp_err_t loki_open(sink_t *sink) {
   uint8_t mac[6] = {0xa, 0xb, 0xc, 0xd, 0xe, 0xf};
   ESP_ERROR_CHECK(esp_read_mac(mac, 0));
   sprintf(mac_id, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  loki_cfg_t _config = get_loki_config();
-  sprintf(post_buff, "{\"streams\": [%s, \"hwid\": \"%s\", \"iname\": \"%s\"", stream_header, mac_id, _config.name);
-  time(&prev_now);
+  pending = (loki_batch_t *) malloc(sizeof(loki_batch_t) + LOKI_BATCH_SIZE);
+  if (!pending) return ESP_ERR_NO_MEM;
+  batch_reset(pending);
   // Prepare client configuration
-  if (!strcmp(_config.host, "")) {
-    vTaskDelete(NULL);
-    return;
-  }
-  esp_http_client_config_t http_config = {
-    .event_handler = _http_event_handle,
-    .method = HTTP_METHOD_POST,
-    .host = _config.host,
-    .port = _config.port,
-    .path = LOKI_PATH,
-    .transport_type = _config.transport,
-  };
-  if (strcmp(_config.username, "")) {
+  http_config.event_handler = _http_event_handle;
+  http_config.method = HTTP_METHOD_POST;
+  http_config.path = LOKI_PATH;
+  http_config.transport_type = loki_config.transport;
+  http_config.timeout_ms = LOKI_TIMEOUT_MS;
+  if (strcmp(loki_config.username, "")) {
     http_config.auth_type = HTTP_AUTH_TYPE_BASIC;
-    http_config.username = strdup(_config.username);
-    http_config.password = strdup(_config.password);
-  }
-  while(1) {
-    xStatus = xQueueReceive(data0_queue, &in_frame, xTicksToWait);
-    if(xStatus == pdPASS) {
-      // -- Make POST body
-      // {
-      //   "streams": [
-      //     {
-      //       "stream": {
-      //         "label": "value"
-      //       },
-      //       "values": [
-      //           [ "<unix epoch in nanoseconds>", "<log line>" ],
-      //           [ "<unix epoch in nanoseconds>", "<log line>" ]
-      //       ]
-      //     }
-      //   ]
-      // }
-      if (log_line_cnt) {
-        strcat(post_buff, ", ");
-        strcat(post_buff, stream_header);
-        sprintf(entry_buff, ", \"hwid\": \"%s\", \"iname\": \"%s\"", mac_id, _config.name);
-        strcat(post_buff, entry_buff);
-      }
-      log_line_cnt++;
-      for (int i = 0; i < LABELS_NUM; i++) {
-        if (in_frame.labels[i][0] != '\0') {
-          sprintf(entry_buff, ", \"%s\": \"%s\"", in_frame.labels[i], in_frame.labels[i + LABELS_NUM]);
-          strcat(post_buff, entry_buff);
-        }
-      }
-      strcat(post_buff, stream_values_header);
-      new_log_usec = (unsigned long int)in_frame.tv.tv_sec * 1000000 + in_frame.tv.tv_usec;
-      if (prev_log_usec < new_log_usec) {
-        prev_log_usec = new_log_usec;
-        log_time_shift = 0;
-      }
-      log_time_shift++;
-      sprintf(entry_buff, "\"%ld%09ld\", \"", in_frame.tv.tv_sec, in_frame.tv.tv_usec * 1000 + log_time_shift);
-      strcat(post_buff, entry_buff);
-      strcat(post_buff, in_frame.log_line);
-      strcat(post_buff, stream_footer);
+    http_config.username = loki_config.username;
+    http_config.password = loki_config.password;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t loki_write(sink_t *sink, const log_data_t *in_frame) {
+  size_t labels_len = 0, line_len = strlen(in_frame->log_line), rec_len, json_len;
+  loki_record_t *rec;
+  char *p;
+
+  for (int i = 0; i < LABELS_NUM; i++) {
+    if (in_frame->labels[i][0] != '\0') {
+      labels_len += strlen(in_frame->labels[i]) + strlen(in_frame->labels[i + LABELS_NUM]) + 2;
     }
+  }
+  rec_len = RECORD_ALIGN(sizeof(loki_record_t) + labels_len + line_len + 1);
+  json_len = ENTRY_OVERHEAD + strlen(loki_config.name) + labels_len + LABELS_NUM * 8 + json_escape_len(in_frame->log_line);
+  if (pending->count && pending->len + rec_len > LOKI_BATCH_SIZE) return ESP_ERR_NO_MEM;
+#if !LOKI_STREAMING
+  if (pending->count && pending->json_len + json_len > JSON_BUFF_SIZE - 32) return ESP_ERR_NO_MEM;
+#endif
 
-    time(&now);
-    if (log_line_cnt && (strlen(post_buff) > JSON_BUFF_SIZE - LOG_LINE_SIZE * 2 || now - prev_now > 1)) {
-      strcat(post_buff, "]}");
-      send_data(post_buff, &http_config);
-      sprintf(post_buff, "{\"streams\": [%s, \"hwid\": \"%s\", \"iname\": \"%s\"", stream_header, mac_id, _config.name);
-      log_line_cnt = 0;
-      prev_now = now;
+  rec = (loki_record_t *)(pending->data + pending->len);
+  new_log_usec = (unsigned long int)in_frame->tv.tv_sec * 1000000 + in_frame->tv.tv_usec;
+  if (prev_log_usec < new_log_usec) {
+    prev_log_usec = new_log_usec;
+    log_time_shift = 0;
+  }
+  log_time_shift++;
+  rec->sec = in_frame->tv.tv_sec;
+  rec->nsec = in_frame->tv.tv_usec * 1000 + log_time_shift;
+  rec->len = rec_len;
+  rec->labels_len = labels_len;
+  rec->level = in_frame->level;
+  p = (char *) RECORD_LABELS(rec);
+  for (int i = 0; i < LABELS_NUM; i++) {
+    if (in_frame->labels[i][0] != '\0') {
+      p = stpcpy(p, in_frame->labels[i]) + 1;
+      p = stpcpy(p, in_frame->labels[i + LABELS_NUM]) + 1;
     }
   }
+  memcpy(p, in_frame->log_line, line_len + 1);
+  pending->len += rec_len;
+  pending->json_len += json_len;
+  pending->count++;
+  return ESP_OK;
+}
+
+static esp_err_t loki_flush(sink_t *sink) {
+  esp_err_t esp_err;
+  TickType_t now = xTaskGetTickCount();
+  loki_batch_t *batch;
+
+  if (retry_head || breaker_open(now)) {
+    // Queue up behind the retries so entries reach Loki in order
+    batch = retry_keep(sink, pending->data, pending->len, pending->count, 0, 0);
+    if (batch) retry_append(batch);
+    esp_err = batch ? SINK_ERR_DEFERRED : ESP_FAIL;
+  } else {
+    esp_err = handle_push(sink, pending, push_any(pending), false);
+  }
+  batch_reset(pending);
+  return esp_err;
+}
+
+// Retries the oldest kept batch once it is due, one push per pass so the
+// sink keeps draining its queue while the endpoint is struggling.
+static void loki_poll(sink_t *sink) {
+  TickType_t now = xTaskGetTickCount();
+  loki_batch_t *batch = retry_head;
+
+  if (!batch || (int32_t)(batch->retry_at - now) > 0 || breaker_open(now)) return;
+  retry_pop();
+  sink->retried += batch->count;
+  handle_push(sink, batch, push_any(batch), true);
+}
+
+static const sink_ops_t loki_sink_ops = {
+  .name = "loki_sink",
+  .queue_size = 12288,
+  .flush_ms = 2000,
+  .stack_size = 8192,
+  .open = loki_open,
+  .write = loki_write,
+  .flush = loki_flush,
+  .poll = loki_poll,
+};
+
+int loki_get_endpoints(loki_endpoint_stat_t *stats, int max) {
+  TickType_t now = xTaskGetTickCount();
+  int num = 0;
+  portENTER_CRITICAL(&endpoints_mux);
+  for (; num < endpoints_num && num < max; num++) {
+    stats[num] = endpoints[num].stat;
+    if (endpoint_open(&endpoints[num], now)) stats[num].state = LOKI_ENDPOINT_DOWN;
+    else if (stats[num].failures) stats[num].state = LOKI_ENDPOINT_DEGRADED;
+    else stats[num].state = LOKI_ENDPOINT_UP;
+  }
+  portEXIT_CRITICAL(&endpoints_mux);
+  return num;
 }
 
 void init_loki() {
-  data0_queue = xQueueCreate(45, sizeof(log_data_t));
-  xTaskCreate(send_data_task, "send_data_task", 8192, NULL, 10, NULL);
+  loki_config = get_loki_config();
+  for (int i = 0; i < loki_config.endpoints_num && i < LOKI_ENDPOINTS_MAX; i++) {
+    if (!strcmp(loki_config.endpoints[i].host, "")) continue;
+    memset(&endpoints[endpoints_num], 0, sizeof(loki_endpoint_t));
+    endpoints[endpoints_num].stat.cfg = loki_config.endpoints[i];
+    endpoints_num++;
+  }
+  if (!endpoints_num) return;
+  if (sink_register(&loki_sink_ops, NULL) != ESP_OK) ESP_LOGE(TAG, "failed to register Loki sink");
 }
@@ -1,29 +1,51 @@
 #ifndef __LOKI_H__
 #define __LOKI_H__
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-
-#include <sys/time.h>
+#include "sink.h"
+#include "store.h"
 
 #define LOKI_PATH "/loki/api/v1/push"
 #define EMITTER_LABEL "esploki"
 #define JOB_LABEL "uarttail"
 
-#define LABELS_NUM 3
-#define LABEL_SIZE 16 + 1
-#define LOG_LINE_SIZE 1024 + 1
+// With LOKI_STREAMING the body is sent with chunked transfer encoding
+// through a small staging buffer, otherwise it is built in a JSON_BUFF_SIZE
+// buffer and sent with a Content-Length.
+#ifndef LOKI_STREAMING
+#define LOKI_STREAMING 1
+#endif
+#define LOKI_STREAM_BUFF_SIZE 2048
 #define JSON_BUFF_SIZE 32768
 #define ENTRY_BUFF_SIZE 128
+#define LOKI_BATCH_SIZE 16384
+#define LOKI_TIMEOUT_MS 5000
+
+#define LOKI_RETRY_BYTES 32768
+#define LOKI_RETRY_MAX 16
+#define LOKI_RETRY_ATTEMPTS 8
+#define LOKI_BACKOFF_MIN_MS 1000
+#define LOKI_BACKOFF_MAX_MS 60000
+#define LOKI_BREAKER_THRESHOLD 3
+#define LOKI_SPLIT_DEPTH 3 // a rejected batch is halved at most this many times
+#define LOKI_LATENCY_WEIGHT 4 // latency EWMA moves 1/4 of the way to each sample
+
+typedef enum {
+  LOKI_ENDPOINT_UP = 0,
+  LOKI_ENDPOINT_DEGRADED, // failed lately, used only if no endpoint is up
+  LOKI_ENDPOINT_DOWN,     // circuit open
+} loki_endpoint_state_t;
 
 typedef struct {
-  struct timeval tv;
-  char labels[LABELS_NUM * 2][LABEL_SIZE];
-  char log_line[LOG_LINE_SIZE];
-} log_data_t;
-
-extern QueueHandle_t data0_queue;
+  loki_endpoint_cfg_t cfg;
+  loki_endpoint_state_t state;
+  uint32_t latency_ms;
+  int failures; // consecutive
+  uint32_t pushes;
+  uint32_t errors;
+  uint32_t sent;
+} loki_endpoint_stat_t;
 
 void init_loki();
+int loki_get_endpoints(loki_endpoint_stat_t *stats, int max);
 
 #endif
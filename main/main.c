@@ -12,9 +12,14 @@
 #include "lwip/apps/sntp.h"
 
 #include "loki.h"
+#include "syslog_sink.h"
+#include "rawtcp.h"
 #include "serial.h"
 #include "webconfig.h"
 #include "store.h"
+#include "filter.h"
+#include "history.h"
+#include "loadtest.h"
 
 #define ESP_WIFI_SSID "SSID"
 #define ESP_WIFI_PASS "passphrase"
@@ -141,6 +146,14 @@ void app_main() {
     localtime_r(&now, &timeinfo);
   }
 
+  init_sinks();
   init_loki();
+  init_syslog();
+  init_rawtcp();
+  init_history();
+  init_filter();
   init_serial();
+#if LOADTEST_ON_BOOT
+  loadtest_start(NULL);
+#endif
 }
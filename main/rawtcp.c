@@ -0,0 +1,56 @@
+#include "rawtcp.h"
+#include "store.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+
+#include <string.h>
+
+static const char *TAG = "rawtcp";
+static sinks_cfg_t sinks_config;
+static char rawtcp_buff[RAWTCP_BUFF_SIZE];
+static int buff_len = 0;
+static int sock = -1;
+
+static esp_err_t rawtcp_write(sink_t *sink, const log_data_t *frame) {
+  int len = strlen(frame->log_line);
+  if (buff_len && buff_len + len + 1 > RAWTCP_BUFF_SIZE) return ESP_ERR_NO_MEM;
+  if (len > RAWTCP_BUFF_SIZE - 1) len = RAWTCP_BUFF_SIZE - 1;
+  memcpy(rawtcp_buff + buff_len, frame->log_line, len);
+  buff_len += len;
+  rawtcp_buff[buff_len++] = '\n';
+  return ESP_OK;
+}
+
+static esp_err_t rawtcp_flush(sink_t *sink) {
+  esp_err_t esp_err = ESP_OK;
+  if (!buff_len) return ESP_OK;
+  if (sock < 0) sock = sink_socket_open(sinks_config.rawtcp_host, sinks_config.rawtcp_port, SOCK_STREAM);
+  if (sock < 0) esp_err = ESP_FAIL;
+  else if (sink_socket_send(sock, rawtcp_buff, buff_len) != ESP_OK) {
+    close(sock);
+    sock = -1;
+    esp_err = ESP_FAIL;
+  }
+  buff_len = 0;
+  return esp_err;
+}
+
+static const sink_ops_t rawtcp_sink_ops = {
+  .name = "rawtcp_sink",
+  .queue_size = 4096,
+  .flush_ms = 500,
+  .stack_size = 4096,
+  .open = NULL,
+  .write = rawtcp_write,
+  .flush = rawtcp_flush,
+  .poll = NULL,
+};
+
+void init_rawtcp() {
+  sinks_config = get_sinks_config();
+  if (!strcmp(sinks_config.rawtcp_host, "")) return;
+  if (sink_register(&rawtcp_sink_ops, NULL) != ESP_OK) ESP_LOGE(TAG, "failed to register raw TCP sink");
+}
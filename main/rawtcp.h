@@ -0,0 +1,10 @@
+#ifndef __RAWTCP_H__
+#define __RAWTCP_H__
+
+#include "sink.h"
+
+#define RAWTCP_BUFF_SIZE 4096
+
+void init_rawtcp();
+
+#endif
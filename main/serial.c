@@ -1,7 +1,8 @@
 #include "serial.h"
 
 #include "utils.h"
-#include "loki.h"
+#include "sink.h"
+#include "filter.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -15,51 +16,54 @@
 static const char *TAG = "serial";
 const int uart_buffer_size = (RD_BUF_SIZE * 2);
 
+// Sanitizes one line, labels it and hands it to the sinks. The frame's
+// timestamp and labels are left to the caller, a line without a level keeps
+// those of the previous line.
+void serial_feed_line(serial_parser_t *parser, char *line) {
+  char *ctmp = parser->ctmp, *ctmp2 = parser->ctmp2;
+  int chunk_len = strlen(line);
+  if (!chunk_len) return;
+  bzero(ctmp, LOG_LINE_SIZE + 1);
+  bzero(ctmp2, LOG_LINE_SIZE + 1);
+  remove_vt100(chunk_len, line, LOG_LINE_SIZE, ctmp);
+  replace_tabs(strlen(ctmp), ctmp, LOG_LINE_SIZE, ctmp2);
+  ESP_LOGD(TAG, "%s", ctmp2);
+  strcpy(parser->out_line.log_line, ctmp2);
+  if (strchr("VDIWE", ctmp2[0]) && ctmp2[1] == ' ' && ctmp2[2] == '(') {
+    parser->out_line.level = ctmp2[0];
+    strcpy(parser->out_line.labels[0], "level");
+    if (ctmp2[0] == 'E') strcpy(parser->out_line.labels[0 + LABELS_NUM], "error");
+    else if (ctmp2[0] == 'W') strcpy(parser->out_line.labels[0 + LABELS_NUM], "warning");
+    else if (ctmp2[0] == 'I') strcpy(parser->out_line.labels[0 + LABELS_NUM], "info");
+    else if (ctmp2[0] == 'D') strcpy(parser->out_line.labels[0 + LABELS_NUM], "debug");
+    else if (ctmp2[0] == 'V') strcpy(parser->out_line.labels[0 + LABELS_NUM], "verbose");
+  }
+  if (filter_check(&parser->out_line)) sink_dispatch(&parser->out_line);
+}
+
 static void uart_event_task(void *pvParameters) {
   uint8_t* dtmp = (uint8_t*) malloc(RD_BUF_SIZE + 1);
-  char* ctmp = (char*) malloc(LOG_LINE_SIZE + 1);
-  char* ctmp2 = (char*) malloc(LOG_LINE_SIZE + 1);
-  log_data_t out_line;
+  serial_parser_t *parser = (serial_parser_t *) malloc(sizeof(serial_parser_t));
+  char *save = NULL;
   for(;;) {
     bzero(dtmp, RD_BUF_SIZE);
-    memset(&out_line, 0, sizeof(log_data_t));
+    memset(&parser->out_line, 0, sizeof(log_data_t));
     int len = uart_read_bytes(EX_UART_NUM, dtmp, RD_BUF_SIZE, 20 / portTICK_RATE_MS);
     if (!len) continue;
     ESP_LOGI(TAG, "[UART DATA]: %d", len);
     ESP_LOGV(TAG, "data: %s", dtmp);
-    gettimeofday(&out_line.tv, NULL);
+    gettimeofday(&parser->out_line.tv, NULL);
     char delim[] = "\r\n";
-    char *ptr = strtok((char *)dtmp, delim);
-    bzero(ctmp, LOG_LINE_SIZE + 1);
-    bzero(ctmp2, LOG_LINE_SIZE + 1);
+    char *ptr = strtok_r((char *)dtmp, delim, &save);
     while(ptr != NULL) {
-      int chunk_len = strlen(ptr);
-      if (chunk_len) {
-        remove_vt100(chunk_len, ptr, LOG_LINE_SIZE, ctmp);
-        replace_tabs(strlen(ctmp), ctmp, LOG_LINE_SIZE, ctmp2);
-        ESP_LOGD(TAG, "%s", ctmp2);
-        strcpy(out_line.log_line, ctmp2);
-        if (strchr("VDIWE", ctmp2[0]) && ctmp2[1] == ' ' && ctmp2[2] == '(') {
-          strcpy(out_line.labels[0], "level");
-          if (ctmp2[0] == 'E') strcpy(out_line.labels[0 + LABELS_NUM], "error");
-          else if (ctmp2[0] == 'W') strcpy(out_line.labels[0 + LABELS_NUM], "warning");
-          else if (ctmp2[0] == 'I') strcpy(out_line.labels[0 + LABELS_NUM], "info");
-          else if (ctmp2[0] == 'D') strcpy(out_line.labels[0 + LABELS_NUM], "debug");
-          else if (ctmp2[0] == 'V') strcpy(out_line.labels[0 + LABELS_NUM], "verbose");
-        }
-        xQueueSendToBack(data0_queue, &out_line, 0);
-      }
-      ptr = strtok(NULL, delim);
-      bzero(ctmp, LOG_LINE_SIZE + 1);
-      bzero(ctmp2, LOG_LINE_SIZE + 1);
+      serial_feed_line(parser, ptr);
+      ptr = strtok_r(NULL, delim, &save);
     }
   }
   free(dtmp);
-  free(ctmp);
-  free(ctmp2);
+  free(parser);
   dtmp = NULL;
-  ctmp = NULL;
-  ctmp2 = NULL;
+  parser = NULL;
   vTaskDelete(NULL);
 }
 
@@ -1,10 +1,20 @@
 #ifndef __SERIAL_H__
 #define __SERIAL_H__
 
+#include "sink.h"
+
 #define EX_UART_NUM UART_NUM_2
 #define UART_RX_PIN 22
 #define RD_BUF_SIZE 8192
 
+// Scratch space for turning raw lines into frames, one per producer task
+typedef struct {
+  char ctmp[LOG_LINE_SIZE + 1];
+  char ctmp2[LOG_LINE_SIZE + 1];
+  log_data_t out_line;
+} serial_parser_t;
+
 void init_serial();
+void serial_feed_line(serial_parser_t *parser, char *line);
 
 #endif
@@ -0,0 +1,242 @@
+#include "sink.h"
+#include "store.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+#include <string.h>
+
+static const char *TAG = "sink";
+static sink_t sinks[SINKS_MAX];
+static int sinks_num = 0;
+static flush_cfg_t flush_config;
+// uart_event_task and loadtest_task both dispatch
+static portMUX_TYPE dispatch_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// 0 for a line without a level, then V, D, I, W, E
+int log_level_idx(char level) {
+  static const char levels[] = "-VDIWE";
+  const char *p = level ? strchr(levels, level) : NULL;
+  return p ? p - levels : 0;
+}
+
+static int hist_bucket(uint32_t ms) {
+  int bucket = 0;
+  while (ms && bucket < SINK_HIST_BUCKETS - 1) {
+    ms >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+// Counts count lines delivered now that were received at since. Called from
+// the sink's own task, by sink_flush or by a sink delivering a kept batch.
+void sink_record_latency(sink_t *sink, const struct timeval *since, unsigned int count) {
+  struct timeval now;
+  int64_t ms;
+  gettimeofday(&now, NULL);
+  ms = (int64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_usec - since->tv_usec) / 1000;
+  if (ms < 0) ms = 0; // the clock was set in between
+  sink->latency_hist[hist_bucket(ms > UINT32_MAX ? UINT32_MAX : (uint32_t) ms)] += count;
+}
+
+// Interpolates within the bucket that holds the pct-th percentile
+uint32_t sink_hist_percentile(const uint32_t *hist, int pct) {
+  uint64_t total = 0, target, seen = 0;
+  for (int i = 0; i < SINK_HIST_BUCKETS; i++) total += hist[i];
+  if (!total) return 0;
+  target = (total * pct + 99) / 100;
+  for (int i = 0; i < SINK_HIST_BUCKETS; i++) {
+    if (seen + hist[i] >= target) {
+      uint32_t lo = i ? 1u << (i - 1) : 0, hi = i ? 1u << i : 1;
+      return lo + (uint32_t)((hi - lo) * (target - seen) / hist[i]);
+    }
+    seen += hist[i];
+  }
+  return 1u << (SINK_HIST_BUCKETS - 1);
+}
+
+static void sink_flush(sink_t *sink) {
+  if (!sink->pending) return;
+  esp_err_t esp_err = sink->ops->flush(sink);
+  if (esp_err == ESP_OK) {
+    sink_record_latency(sink, &sink->batch_tv, sink->pending);
+    sink->sent += sink->pending;
+  } else if (esp_err != SINK_ERR_DEFERRED) sink->failed += sink->pending;
+  sink->pending = 0;
+}
+
+// Moves the batch deadline up to the frame's hold time, so an error goes
+// out within its hold while a stream of info lines keeps batching.
+static void sink_hold(TickType_t *flush_at, char level, TickType_t now) {
+  uint32_t hold_ms = flush_config.hold_ms[log_level_idx(level)];
+  if (hold_ms && (int32_t)(now + pdMS_TO_TICKS(hold_ms) - *flush_at) < 0) *flush_at = now + pdMS_TO_TICKS(hold_ms);
+}
+
+static void sink_task(void *arg) {
+  sink_t *sink = (sink_t *) arg;
+  const TickType_t flush_ticks = pdMS_TO_TICKS(sink->ops->flush_ms);
+  TickType_t flush_at = 0, now, wait;
+  esp_err_t esp_err;
+  size_t frame_len;
+  void *item;
+
+  while(1) {
+    // Wake up no later than the batch deadline
+    wait = pdMS_TO_TICKS(100);
+    if (sink->pending) {
+      now = xTaskGetTickCount();
+      if ((int32_t)(flush_at - now) <= 0) wait = 0;
+      else if (flush_at - now < wait) wait = flush_at - now;
+    }
+    item = xRingbufferReceive(sink->queue, &frame_len, wait);
+    if (item) {
+      memcpy(&sink->frame, item, frame_len);
+      vRingbufferReturnItem(sink->queue, item);
+      esp_err = sink->ops->write(sink, &sink->frame);
+      if (esp_err == ESP_ERR_NO_MEM) {
+        sink_flush(sink);
+        esp_err = sink->ops->write(sink, &sink->frame);
+      }
+      if (esp_err == ESP_OK) {
+        now = xTaskGetTickCount();
+        if (!sink->pending) {
+          flush_at = now + flush_ticks;
+          sink->batch_tv = sink->frame.tv;
+        }
+        sink_hold(&flush_at, sink->frame.level, now);
+        sink->pending++;
+      } else {
+        sink->failed++;
+      }
+    }
+    if (sink->ops->poll) sink->ops->poll(sink);
+    if (sink->pending && (int32_t)(xTaskGetTickCount() - flush_at) >= 0) sink_flush(sink);
+  }
+}
+
+void init_sinks() {
+  flush_config = get_flush_config();
+}
+
+esp_err_t sink_register(const sink_ops_t *ops, void *ctx) {
+  if (sinks_num >= SINKS_MAX) return ESP_ERR_NO_MEM;
+  sink_t *sink = &sinks[sinks_num];
+  memset(sink, 0, sizeof(sink_t));
+  sink->ops = ops;
+  sink->ctx = ctx;
+  // Nothing is torn down after the sink is counted in sinks_num, so
+  // sink_dispatch() never sees a queue go away
+  if (ops->open && ops->open(sink) != ESP_OK) {
+    ESP_LOGE(TAG, "%s: failed to open, sink disabled", ops->name);
+    return ESP_FAIL;
+  }
+  sink->queue = xRingbufferCreate(ops->queue_size, RINGBUF_TYPE_NOSPLIT);
+  if (!sink->queue) return ESP_ERR_NO_MEM;
+  if (xTaskCreate(sink_task, ops->name, ops->stack_size, sink, 10, NULL) != pdPASS) {
+    vRingbufferDelete(sink->queue);
+    sink->queue = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  sinks_num++;
+  ESP_LOGI(TAG, "%s: registered", ops->name);
+  return ESP_OK;
+}
+
+// Hands the frame to every sink without blocking. A sink whose queue is full
+// drops the frame on its own, the others still get it. Only the header and
+// the used part of log_line are copied, a typical line takes ~200 bytes of
+// queue instead of a whole log_data_t.
+void sink_dispatch(const log_data_t *frame) {
+  size_t frame_len = offsetof(log_data_t, log_line) + strlen(frame->log_line) + 1;
+  bool sent;
+  for (int i = 0; i < sinks_num; i++) {
+    sent = xRingbufferSend(sinks[i].queue, frame, frame_len, 0) == pdTRUE;
+    portENTER_CRITICAL(&dispatch_mux);
+    if (sent) sinks[i].queued++;
+    else sinks[i].dropped++;
+    portEXIT_CRITICAL(&dispatch_mux);
+  }
+}
+
+int sink_count() {
+  return sinks_num;
+}
+
+const sink_t *sink_get(int idx) {
+  if (idx < 0 || idx >= sinks_num) return NULL;
+  return &sinks[idx];
+}
+
+// Connects without blocking for longer than SINK_SOCKET_TIMEOUT_MS
+static int sink_socket_connect(int sock, const struct addrinfo *res) {
+  struct timeval timeout = { .tv_sec = SINK_SOCKET_TIMEOUT_MS / 1000, .tv_usec = (SINK_SOCKET_TIMEOUT_MS % 1000) * 1000 };
+  int flags = fcntl(sock, F_GETFL, 0), err = 0;
+  socklen_t err_len = sizeof(err);
+  fd_set wfds;
+
+  fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+  if (connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+    if (errno != EINPROGRESS) return -1;
+    FD_ZERO(&wfds);
+    FD_SET(sock, &wfds);
+    if (select(sock + 1, NULL, &wfds, NULL, &timeout) <= 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err) {
+      errno = err;
+      return -1;
+    }
+  }
+  fcntl(sock, F_SETFL, flags);
+  return 0;
+}
+
+int sink_socket_open(const char *host, int port, int type) {
+  struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = type };
+  struct timeval timeout = { .tv_sec = SINK_SOCKET_TIMEOUT_MS / 1000, .tv_usec = (SINK_SOCKET_TIMEOUT_MS % 1000) * 1000 };
+  struct addrinfo *res;
+  char port_str[8];
+  int sock;
+
+  sprintf(port_str, "%d", port);
+  if (getaddrinfo(host, port_str, &hints, &res) != 0 || res == NULL) {
+    ESP_LOGW(TAG, "DNS lookup failed for %s", host);
+    return -1;
+  }
+  sock = socket(res->ai_family, res->ai_socktype, 0);
+  if (sock < 0) {
+    ESP_LOGW(TAG, "failed to allocate socket");
+    freeaddrinfo(res);
+    return -1;
+  }
+  if (sink_socket_connect(sock, res) != 0) {
+    ESP_LOGW(TAG, "failed to connect to %s:%d, errno=%d", host, port, errno);
+    close(sock);
+    freeaddrinfo(res);
+    return -1;
+  }
+  freeaddrinfo(res);
+  // A collector that stops reading must not hold the sink task for lwIP's
+  // default retransmission timeout on every flush
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  return sock;
+}
+
+esp_err_t sink_socket_send(int sock, const char *data, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    int ret = send(sock, data + written, len - written, 0);
+    if (ret < 0) {
+      ESP_LOGW(TAG, "send failed, errno=%d", errno);
+      return ESP_FAIL;
+    }
+    written += ret;
+  }
+  return ESP_OK;
+}
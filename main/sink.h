@@ -0,0 +1,90 @@
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#define LABELS_NUM 3
+#define LABEL_SIZE 16 + 1
+#define LOG_LINE_SIZE 1024 + 1
+#define SINKS_MAX 4
+#define SINK_SOCKET_TIMEOUT_MS 3000 // connect and send, per call
+// Returned by flush when the sink kept the batch for a later retry, it then
+// accounts for those frames in sent/failed on its own. Sink errors live
+// above the ESP-IDF error code ranges.
+#define SINK_ERR_BASE 0x10000
+#define SINK_ERR_DEFERRED (SINK_ERR_BASE + 1)
+// Delivery latency histograms have a bucket per power of two: bucket 0 holds
+// 0 ms, bucket i holds [2^(i-1), 2^i) ms and the last one everything above.
+#define SINK_HIST_BUCKETS 16
+#define LOG_LEVELS 6 // no level, V, D, I, W, E, see log_level_idx()
+#define LOG_HASH_INIT 2166136261u
+
+typedef struct {
+  struct timeval tv;
+  char level; // 'E', 'W', 'I', 'D', 'V' or '\0' if the line has no ESP-IDF prefix
+  char labels[LABELS_NUM * 2][LABEL_SIZE];
+  char log_line[LOG_LINE_SIZE];
+} log_data_t;
+
+// FNV-1a, folds one more byte into a hash started at LOG_HASH_INIT
+static inline uint32_t log_hash_add(uint32_t hash, uint8_t c) {
+  return (hash ^ c) * 16777619u;
+}
+
+typedef struct sink sink_t;
+
+// A sink batches frames and ships them somewhere. All callbacks but open run
+// in the sink's own task, so a slow sink only ever stalls itself.
+typedef struct {
+  const char *name;
+  size_t queue_size; // bytes, frames are queued with only their used part of log_line
+  uint32_t flush_ms;
+  uint32_t stack_size;
+  // Called once by sink_register(), before the sink gets any frame. A sink
+  // that fails to open is not registered.
+  esp_err_t (*open)(sink_t *sink);
+  // Appends a frame to the current batch. Returns ESP_ERR_NO_MEM when the
+  // frame doesn't fit, the batch is then flushed and the write retried once.
+  esp_err_t (*write)(sink_t *sink, const log_data_t *frame);
+  // Ships the current batch and starts a new one. Called every flush_ms, or
+  // sooner when a line's level has a shorter hold time (see flush_cfg_t).
+  esp_err_t (*flush)(sink_t *sink);
+  // Optional, called on every pass of the sink task (at least every 100 ms).
+  void (*poll)(sink_t *sink);
+} sink_ops_t;
+
+struct sink {
+  const sink_ops_t *ops;
+  void *ctx;
+  RingbufHandle_t queue;
+  unsigned int pending;
+  uint32_t queued;
+  uint32_t dropped;
+  uint32_t sent;
+  uint32_t failed;
+  uint32_t retried;
+  // Lines by time from reception to delivery, each line of a batch counted
+  // at the age of the batch's oldest one
+  uint32_t latency_hist[SINK_HIST_BUCKETS];
+  struct timeval batch_tv; // reception of the oldest line in the batch
+  log_data_t frame;
+};
+
+void init_sinks();
+int log_level_idx(char level);
+void sink_record_latency(sink_t *sink, const struct timeval *since, unsigned int count);
+uint32_t sink_hist_percentile(const uint32_t *hist, int pct);
+esp_err_t sink_register(const sink_ops_t *ops, void *ctx);
+void sink_dispatch(const log_data_t *frame);
+int sink_count();
+const sink_t *sink_get(int idx);
+int sink_socket_open(const char *host, int port, int type);
+esp_err_t sink_socket_send(int sock, const char *data, size_t len);
+
+#endif
@@ -14,7 +14,20 @@ static const char store_nvs_namespace[] = "esptail_store";
 char sta_ssid[32] = "";
 char sta_password[64] = "";
 SemaphoreHandle_t store_mutex = NULL;
-loki_cfg_t _curr_config = { .transport=HTTP_TRANSPORT_OVER_TCP, .host="", .port=80, .username="", .password="", .name="esp" };
+loki_cfg_t _curr_config = { .transport=HTTP_TRANSPORT_OVER_TCP, .endpoints_num=0, .mode=LOKI_MODE_FAILOVER, .username="", .password="", .name="esp" };
+
+// Single endpoint layout saved under "loki_cfg" by older firmware
+typedef struct loki_cfg_v1 {
+  esp_http_client_transport_t transport;
+  char host[512];
+  int port;
+  char username[64];
+  char password[64];
+  char name[128];
+} loki_cfg_v1_t;
+sinks_cfg_t _curr_sinks_config = { .syslog_transport=SINK_TRANSPORT_UDP, .syslog_host="", .syslog_port=514, .rawtcp_host="", .rawtcp_port=5170 };
+flush_cfg_t _curr_flush_config = { .hold_ms={ 0, 0, 0, 0, 500, 100 } };
+filters_cfg_t _curr_filters_config = { .rules_num=0 };
 
 bool lock_store(TickType_t xTicksToWait) {
   if (!store_mutex) store_mutex = xSemaphoreCreateMutex();
@@ -113,14 +126,14 @@ esp_err_t wifi_load_settings() {
   return esp_err;
 }
 
-esp_err_t _loki_config_save() {
+esp_err_t _config_save(const char *key, const void *config, size_t sz) {
   nvs_handle handle;
   esp_err_t esp_err;
 
   esp_err = nvs_open(store_nvs_namespace, NVS_READWRITE, &handle);
   if (esp_err != ESP_OK) return esp_err;
 
-  esp_err = nvs_set_blob(handle, "loki_cfg", &_curr_config, sizeof(_curr_config));
+  esp_err = nvs_set_blob(handle, key, config, sz);
   if (esp_err == ESP_OK) {
     esp_err = nvs_commit(handle);
   }
@@ -130,31 +143,28 @@ esp_err_t _loki_config_save() {
   return esp_err;
 }
 
-esp_err_t _loki_config_load() {
+esp_err_t _config_load(const char *key, void *config, size_t sz) {
   nvs_handle handle;
   esp_err_t esp_err;
 
   esp_err = nvs_open(store_nvs_namespace, NVS_READONLY, &handle);
   if (esp_err != ESP_OK) return esp_err;
 
-  size_t sz = sizeof(_curr_config);
-  if (esp_err == ESP_OK) {
-    esp_err = nvs_get_blob(handle, "loki_cfg", &_curr_config, &sz);
-  }
+  esp_err = nvs_get_blob(handle, key, config, &sz);
 
   nvs_close(handle);
 
   if (esp_err != ESP_OK) {
-    ESP_LOGD(TAG, "Loki config load failed");
+    ESP_LOGD(TAG, "%s load failed", key);
   } else {
-    ESP_LOGD(TAG, "Loki config loaded successfully");
+    ESP_LOGD(TAG, "%s loaded successfully", key);
   }
 
   return esp_err;
 }
 
 loki_cfg_t get_loki_config() {
-  loki_cfg_t _config = { .transport=HTTP_TRANSPORT_OVER_TCP, .host="", .port=80, .username="", .password="", .name="esp" };
+  loki_cfg_t _config = { .transport=HTTP_TRANSPORT_OVER_TCP, .endpoints_num=0, .mode=LOKI_MODE_FAILOVER, .username="", .password="", .name="esp" };
   size_t sz = sizeof(loki_cfg_t);
   if (lock_store(portMAX_DELAY)) {
     memcpy(&_config, &_curr_config, sz);
@@ -171,7 +181,7 @@ esp_err_t set_loki_config(loki_cfg_t config) {
 
   if (lock_store(portMAX_DELAY)) {
     memcpy(&_curr_config, &config, sz);
-    esp_err = _loki_config_save();
+    esp_err = _config_save("loki_cfg2", &_curr_config, sz);
     unlock_store();
   } else {
     ESP_LOGW(TAG, "Data access timeout or mutex not created.");
@@ -183,13 +193,129 @@ esp_err_t set_loki_config(loki_cfg_t config) {
   return esp_err;
 }
 
+sinks_cfg_t get_sinks_config() {
+  sinks_cfg_t _config = { .syslog_transport=SINK_TRANSPORT_UDP, .syslog_host="", .syslog_port=514, .rawtcp_host="", .rawtcp_port=5170 };
+  if (lock_store(portMAX_DELAY)) {
+    memcpy(&_config, &_curr_sinks_config, sizeof(sinks_cfg_t));
+    unlock_store();
+  } else {
+    ESP_LOGW(TAG, "Data access timeout or mutex not created.");
+  }
+  return _config;
+}
+
+esp_err_t set_sinks_config(sinks_cfg_t config) {
+  esp_err_t esp_err;
+
+  if (lock_store(portMAX_DELAY)) {
+    memcpy(&_curr_sinks_config, &config, sizeof(sinks_cfg_t));
+    esp_err = _config_save("sinks_cfg", &_curr_sinks_config, sizeof(sinks_cfg_t));
+    unlock_store();
+  } else {
+    ESP_LOGW(TAG, "Data access timeout or mutex not created.");
+    return ESP_FAIL;
+  }
+
+  if (esp_err != ESP_OK) ESP_LOGW(TAG, "Failed to save sinks configuration.");
+
+  return esp_err;
+}
+
+flush_cfg_t get_flush_config() {
+  flush_cfg_t _config = { .hold_ms={ 0, 0, 0, 0, 500, 100 } };
+  if (lock_store(portMAX_DELAY)) {
+    memcpy(&_config, &_curr_flush_config, sizeof(flush_cfg_t));
+    unlock_store();
+  } else {
+    ESP_LOGW(TAG, "Data access timeout or mutex not created.");
+  }
+  return _config;
+}
+
+esp_err_t set_flush_config(flush_cfg_t config) {
+  esp_err_t esp_err;
+
+  if (lock_store(portMAX_DELAY)) {
+    memcpy(&_curr_flush_config, &config, sizeof(flush_cfg_t));
+    esp_err = _config_save("flush_cfg", &_curr_flush_config, sizeof(flush_cfg_t));
+    unlock_store();
+  } else {
+    ESP_LOGW(TAG, "Data access timeout or mutex not created.");
+    return ESP_FAIL;
+  }
+
+  if (esp_err != ESP_OK) ESP_LOGW(TAG, "Failed to save flush configuration.");
+
+  return esp_err;
+}
+
+filters_cfg_t get_filters_config() {
+  filters_cfg_t _config = { .rules_num=0 };
+  if (lock_store(portMAX_DELAY)) {
+    memcpy(&_config, &_curr_filters_config, sizeof(filters_cfg_t));
+    unlock_store();
+  } else {
+    ESP_LOGW(TAG, "Data access timeout or mutex not created.");
+  }
+  return _config;
+}
+
+esp_err_t set_filters_config(filters_cfg_t config) {
+  esp_err_t esp_err;
+
+  if (lock_store(portMAX_DELAY)) {
+    memcpy(&_curr_filters_config, &config, sizeof(filters_cfg_t));
+    esp_err = _config_save("filters_cfg", &_curr_filters_config, sizeof(filters_cfg_t));
+    unlock_store();
+  } else {
+    ESP_LOGW(TAG, "Data access timeout or mutex not created.");
+    return ESP_FAIL;
+  }
+
+  if (esp_err != ESP_OK) ESP_LOGW(TAG, "Failed to save filters configuration.");
+
+  return esp_err;
+}
+
 esp_err_t reset_store() {
   return nvs_flash_erase();
 }
 
-esp_err_t store_init() {
+static esp_err_t _loki_config_migrate() {
+  loki_cfg_v1_t *old = (loki_cfg_v1_t *) malloc(sizeof(loki_cfg_v1_t));
   esp_err_t esp_err;
-  esp_err = _loki_config_load();
-  if (esp_err != ESP_OK) return esp_err;
-  return ESP_OK;
+
+  if (!old) return ESP_ERR_NO_MEM;
+  esp_err = _config_load("loki_cfg", old, sizeof(loki_cfg_v1_t));
+  if (esp_err == ESP_OK) {
+    _curr_config.transport = old->transport;
+    _curr_config.endpoints_num = 0;
+    if (strcmp(old->host, "")) {
+      strlcpy(_curr_config.endpoints[0].host, old->host, sizeof(_curr_config.endpoints[0].host));
+      _curr_config.endpoints[0].port = old->port;
+      _curr_config.endpoints_num = 1;
+    }
+    _curr_config.mode = LOKI_MODE_FAILOVER;
+    strcpy(_curr_config.username, old->username);
+    strcpy(_curr_config.password, old->password);
+    strcpy(_curr_config.name, old->name);
+    ESP_LOGI(TAG, "migrated single endpoint loki_cfg");
+  }
+  free(old);
+  return esp_err;
+}
+
+esp_err_t store_init() {
+  esp_err_t esp_err, ret = ESP_OK;
+  // Every blob is loaded on its own, a missing one keeps its defaults
+  esp_err = _config_load("loki_cfg2", &_curr_config, sizeof(_curr_config));
+  if (esp_err != ESP_OK) esp_err = _loki_config_migrate();
+  if (esp_err != ESP_OK) ret = esp_err;
+  esp_err = _config_load("sinks_cfg", &_curr_sinks_config, sizeof(_curr_sinks_config));
+  if (esp_err != ESP_OK) ret = esp_err;
+  esp_err = _config_load("flush_cfg", &_curr_flush_config, sizeof(_curr_flush_config));
+  if (esp_err != ESP_OK) ret = esp_err;
+  esp_err = _config_load("filters_cfg", &_curr_filters_config, sizeof(_curr_filters_config));
+  if (esp_err != ESP_OK) ret = esp_err;
+  return ret;
 }
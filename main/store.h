@@ -5,15 +5,75 @@
 
 #include "esp_http_client.h"
 
+#include "sink.h"
+
+#define LOKI_ENDPOINTS_MAX 4
+
+typedef struct loki_endpoint_cfg {
+  char host[128];
+  int port;
+} loki_endpoint_cfg_t;
+
+typedef enum {
+  LOKI_MODE_FAILOVER = 0, // every batch goes to the healthiest endpoint
+  // Batches rotate over all healthy endpoints to share the load between
+  // them. Pushes still go out one at a time, so this adds no throughput.
+  LOKI_MODE_SPREAD,
+} loki_mode_t;
+
+// Endpoints share the transport and credentials, they are expected to be
+// replicas or load balancers in front of the same Loki.
 typedef struct loki_cfg {
   esp_http_client_transport_t transport;
-  char host[512];
-  int port;
+  int endpoints_num;
+  loki_endpoint_cfg_t endpoints[LOKI_ENDPOINTS_MAX];
+  loki_mode_t mode;
   char username[64];
   char password[64];
   char name[128];
 } loki_cfg_t;
 
+typedef enum {
+  SINK_TRANSPORT_UDP = 0,
+  SINK_TRANSPORT_TCP,
+} sink_transport_t;
+
+typedef struct sinks_cfg {
+  sink_transport_t syslog_transport;
+  char syslog_host[128];
+  int syslog_port;
+  char rawtcp_host[128];
+  int rawtcp_port;
+} sinks_cfg_t;
+
+// Longest time a line of each level may wait in a sink's batch before the
+// batch is flushed, 0 leaves the level to the sink's own flush interval.
+typedef struct flush_cfg {
+  uint32_t hold_ms[LOG_LEVELS];
+} flush_cfg_t;
+
+#define FILTER_RULES_MAX 16
+#define FILTER_TAG_SIZE 24
+
+typedef enum {
+  FILTER_KEEP = 0,
+  FILTER_DROP,
+  FILTER_SAMPLE, // keep 1 line in arg
+  FILTER_RATE,   // keep at most arg lines per second
+} filter_action_t;
+
+typedef struct filter_rule {
+  char level; // 'E', 'W', 'I', 'D', 'V', '-' for lines without a level or '*' for any
+  char tag[FILTER_TAG_SIZE]; // "" matches any tag
+  filter_action_t action;
+  uint32_t arg;
+} filter_rule_t;
+
+typedef struct filters_cfg {
+  int rules_num;
+  filter_rule_t rules[FILTER_RULES_MAX];
+} filters_cfg_t;
+
 extern char sta_ssid[32];
 extern char sta_password[64];
 
@@ -21,6 +81,12 @@ esp_err_t wifi_save_settings();
 esp_err_t wifi_load_settings();
 loki_cfg_t get_loki_config();
 esp_err_t set_loki_config(loki_cfg_t config);
+sinks_cfg_t get_sinks_config();
+esp_err_t set_sinks_config(sinks_cfg_t config);
+flush_cfg_t get_flush_config();
+esp_err_t set_flush_config(flush_cfg_t config);
+filters_cfg_t get_filters_config();
+esp_err_t set_filters_config(filters_cfg_t config);
 esp_err_t reset_store();
 esp_err_t store_init();
 
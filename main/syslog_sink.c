@@ -0,0 +1,117 @@
+#include "syslog_sink.h"
+#include "store.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "syslog";
+static sinks_cfg_t sinks_config;
+static char hostname[128];
+static char syslog_buff[SYSLOG_BUFF_SIZE];
+static char msg_buff[LOG_LINE_SIZE + 160];
+static int buff_len = 0;
+static int sock = -1;
+
+static int syslog_severity(char level) {
+  switch(level) {
+    case 'E': return 3;
+    case 'W': return 4;
+    case 'I': return 6;
+    case 'D':
+    case 'V': return 7;
+    default: return 5;
+  }
+}
+
+// RFC 5424: <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG
+static int syslog_format(const log_data_t *frame, char *out, size_t out_size) {
+  struct tm timeinfo;
+  char ts[24];
+  int len;
+
+  gmtime_r(&frame->tv.tv_sec, &timeinfo);
+  strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &timeinfo);
+  len = snprintf(out, out_size, "<%d>1 %s.%06ldZ %s " SYSLOG_APP_NAME " - - - %s",
+                 SYSLOG_FACILITY * 8 + syslog_severity(frame->level), ts, frame->tv.tv_usec, hostname, frame->log_line);
+  return len < out_size ? len : out_size - 1;
+}
+
+static bool syslog_connect() {
+  if (sock >= 0) return true;
+  sock = sink_socket_open(sinks_config.syslog_host, sinks_config.syslog_port,
+                          sinks_config.syslog_transport == SINK_TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM);
+  return sock >= 0;
+}
+
+static void syslog_disconnect() {
+  if (sock < 0) return;
+  close(sock);
+  sock = -1;
+}
+
+static esp_err_t syslog_open(sink_t *sink) {
+  loki_cfg_t loki_config = get_loki_config();
+  // HOSTNAME must be a single printable token
+  strcpy(hostname, strcmp(loki_config.name, "") ? loki_config.name : "-");
+  for (char *c = hostname; *c; c++) {
+    if (*c <= ' ' || *c > '~') *c = '_';
+  }
+  return ESP_OK;
+}
+
+// Messages are batched with octet-counting framing (RFC 6587) for either
+// transport, TCP sends the batch as is and UDP a datagram per message.
+static esp_err_t syslog_write(sink_t *sink, const log_data_t *frame) {
+  int len = syslog_format(frame, msg_buff, sizeof(msg_buff));
+
+  if (buff_len && buff_len + len + 8 > SYSLOG_BUFF_SIZE) return ESP_ERR_NO_MEM;
+  buff_len += snprintf(syslog_buff + buff_len, SYSLOG_BUFF_SIZE - buff_len, "%d %s", len, msg_buff);
+  if (buff_len >= SYSLOG_BUFF_SIZE) buff_len = SYSLOG_BUFF_SIZE - 1;
+  return ESP_OK;
+}
+
+static esp_err_t syslog_send_datagrams() {
+  char *p = syslog_buff, *end = syslog_buff + buff_len, *msg;
+  long len;
+
+  while (p < end) {
+    len = strtol(p, &msg, 10);
+    if (*msg != ' ' || len <= 0 || ++msg + len > end) break;
+    if (send(sock, msg, len, 0) < 0) return ESP_FAIL;
+    p = msg + len;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t syslog_flush(sink_t *sink) {
+  esp_err_t esp_err = ESP_OK;
+  if (!buff_len) return ESP_OK;
+  if (!syslog_connect()) esp_err = ESP_FAIL;
+  else if (sinks_config.syslog_transport == SINK_TRANSPORT_UDP) esp_err = syslog_send_datagrams();
+  else esp_err = sink_socket_send(sock, syslog_buff, buff_len);
+  if (esp_err != ESP_OK) syslog_disconnect();
+  buff_len = 0;
+  return esp_err;
+}
+
+static const sink_ops_t syslog_sink_ops = {
+  .name = "syslog_sink",
+  .queue_size = 4096,
+  .flush_ms = 1000,
+  .stack_size = 4096,
+  .open = syslog_open,
+  .write = syslog_write,
+  .flush = syslog_flush,
+  .poll = NULL,
+};
+
+void init_syslog() {
+  sinks_config = get_sinks_config();
+  if (!strcmp(sinks_config.syslog_host, "")) return;
+  if (sink_register(&syslog_sink_ops, NULL) != ESP_OK) ESP_LOGE(TAG, "failed to register syslog sink");
+}
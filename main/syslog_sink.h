@@ -0,0 +1,12 @@
+#ifndef __SYSLOG_SINK_H__
+#define __SYSLOG_SINK_H__
+
+#include "sink.h"
+
+#define SYSLOG_APP_NAME "esptail"
+#define SYSLOG_FACILITY 16 // local0
+#define SYSLOG_BUFF_SIZE 4096
+
+void init_syslog();
+
+#endif
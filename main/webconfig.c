@@ -9,14 +9,32 @@
 #include "string.h"
 #include "cJSON.h"
 #include "esp_http_client.h"
+#include "mbedtls/sha256.h"
 
 #include "store.h"
+#include "sink.h"
+#include "filter.h"
+#include "history.h"
+#include "loki.h"
+#include "loadtest.h"
+
+#include <ctype.h>
+#include <time.h>
 
 static const char *TAG = "WS";
 #define SCRATCH_BUFSIZE (1024)
+#define FILTERS_BUFSIZE (2048)
+#define SEARCH_BUFSIZE (2048)
+#define SEARCH_LIMIT 1000
 
 static esp_err_t index_get_handler(httpd_req_t *req);
 static esp_err_t post_handler(httpd_req_t *req);
+static esp_err_t status_get_handler(httpd_req_t *req);
+static esp_err_t filters_get_handler(httpd_req_t *req);
+static esp_err_t filters_post_handler(httpd_req_t *req);
+static esp_err_t search_get_handler(httpd_req_t *req);
+static esp_err_t loadtest_get_handler(httpd_req_t *req);
+static esp_err_t loadtest_post_handler(httpd_req_t *req);
 
 httpd_uri_t uri_get = {
   .uri      = "/*",
@@ -32,6 +50,74 @@ httpd_uri_t config_post = {
   .user_ctx = NULL
 };
 
+httpd_uri_t status_get = {
+  .uri      = "/status",
+  .method   = HTTP_GET,
+  .handler  = status_get_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t filters_get = {
+  .uri      = "/filters",
+  .method   = HTTP_GET,
+  .handler  = filters_get_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t filters_post = {
+  .uri      = "/filters",
+  .method   = HTTP_POST,
+  .handler  = filters_post_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t search_get = {
+  .uri      = "/search",
+  .method   = HTTP_GET,
+  .handler  = search_get_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t loadtest_get = {
+  .uri      = "/loadtest",
+  .method   = HTTP_GET,
+  .handler  = loadtest_get_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t loadtest_post = {
+  .uri      = "/loadtest",
+  .method   = HTTP_POST,
+  .handler  = loadtest_post_handler,
+  .user_ctx = NULL
+};
+
+extern const unsigned char esp_tail_png_start[] asm("_binary_esp_tail_png_start");
+extern const unsigned char esp_tail_png_end[]   asm("_binary_esp_tail_png_end");
+extern const unsigned char index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const unsigned char index_html_gz_end[]   asm("_binary_index_html_gz_end");
+
+typedef struct {
+  const char *uri;
+  const char *type;
+  const char *encoding;
+  const char *cache_control;
+  const unsigned char *start;
+  const unsigned char *end;
+  char etag[20];
+} web_asset_t;
+
+// The page revalidates on every load (a 304 is a few bytes), the icon is
+// cached for a day.
+static web_asset_t web_assets[] = {
+  { "/", "text/html", "gzip", "no-cache", index_html_gz_start, index_html_gz_end, "" },
+  { "/esp-tail.png", "image/png", NULL, "max-age=86400", esp_tail_png_start, esp_tail_png_end, "" },
+};
+
+static const char *filter_actions[] = { "keep", "drop", "sample", "rate" };
+static const char *endpoint_states[] = { "up", "degraded", "down" };
+static const char *loadtest_states[] = { "idle", "running", "done", "stopped" };
+
 httpd_handle_t start_webserver() {
   ESP_LOGI(TAG, "Starting web server");
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
@@ -41,6 +127,12 @@ httpd_handle_t start_webserver() {
   httpd_handle_t server = NULL;
 
   if (httpd_start(&server, &config) == ESP_OK) {
+    httpd_register_uri_handler(server, &status_get);
+    httpd_register_uri_handler(server, &filters_get);
+    httpd_register_uri_handler(server, &filters_post);
+    httpd_register_uri_handler(server, &search_get);
+    httpd_register_uri_handler(server, &loadtest_get);
+    httpd_register_uri_handler(server, &loadtest_post);
     httpd_register_uri_handler(server, &uri_get);
     httpd_register_uri_handler(server, &config_post);
   }
@@ -52,6 +144,31 @@ void stop_webserver(httpd_handle_t server) {
   httpd_stop(server);
 }
 
+static esp_err_t send_asset(httpd_req_t *req, web_asset_t *asset) {
+  const size_t size = asset->end - asset->start;
+  char if_none_match[64];
+
+  // Strong ETag: the first 64 bits of the content's SHA-256
+  if (asset->etag[0] == '\0') {
+    unsigned char sha[32];
+    mbedtls_sha256_ret(asset->start, size, sha, 0);
+    sprintf(asset->etag, "\"%02x%02x%02x%02x%02x%02x%02x%02x\"", sha[0], sha[1], sha[2], sha[3], sha[4], sha[5], sha[6], sha[7]);
+  }
+  httpd_resp_set_hdr(req, "ETag", asset->etag);
+  httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+
+  if (httpd_req_get_hdr_value_len(req, "If-None-Match") < sizeof(if_none_match) &&
+      httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+      strstr(if_none_match, asset->etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  httpd_resp_set_type(req, asset->type);
+  if (asset->encoding) httpd_resp_set_hdr(req, "Content-Encoding", asset->encoding);
+  return httpd_resp_send(req, (const char *)asset->start, size);
+}
+
 static esp_err_t index_get_handler(httpd_req_t *req) {
   if (strcmp(req->uri, "/scan") == 0) {
     uint16_t ap_num = 0;
@@ -78,38 +195,75 @@ static esp_err_t index_get_handler(httpd_req_t *req) {
       free(ap_records);
     }
   }
-  else if (strcmp(req->uri, "/esp-tail.png") == 0) {
-    extern const unsigned char esp_tail_png_start[] asm("_binary_esp_tail_png_start");
-    extern const unsigned char esp_tail_png_end[]   asm("_binary_esp_tail_png_end");
-    const size_t esp_tail_png_size = (esp_tail_png_end - esp_tail_png_start);
-    httpd_resp_set_type(req, "image/png");
-    httpd_resp_send(req, (const char *)esp_tail_png_start, esp_tail_png_size);
+  else {
+    for (int i = 0; i < sizeof(web_assets) / sizeof(web_assets[0]); i++) {
+      if (strcmp(req->uri, web_assets[i].uri) == 0) return send_asset(req, &web_assets[i]);
+    }
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Page does not exist");
   }
-  else if (strcmp(req->uri, "/") == 0) {
-    extern const unsigned char index_html_start[] asm("_binary_index_html_start");
-    extern const unsigned char index_html_end[]   asm("_binary_index_html_end");
-    const size_t index_html_size = (index_html_end - index_html_start);
 
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, (const char *)index_html_start, index_html_size);
-  } else {
-    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Page does not exist");
+  return ESP_OK;
+}
+
+// Escapes str for a JSON string value, truncated to fit size
+static char *json_escape(const char *str, char *out, size_t size) {
+  size_t len = 0;
+  for (; *str && len + 7 < size; str++) {
+    if (*str == '"' || *str == '\\') {
+      out[len++] = '\\';
+      out[len++] = *str;
+    } else if ((uint8_t) *str < ' ') {
+      len += sprintf(out + len, "\\u%04x", (uint8_t) *str);
+    } else {
+      out[len++] = *str;
+    }
   }
+  out[len] = '\0';
+  return out;
+}
 
+static esp_err_t status_get_handler(httpd_req_t *req) {
+  loki_endpoint_stat_t endpoints[LOKI_ENDPOINTS_MAX];
+  int endpoints_num = loki_get_endpoints(endpoints, LOKI_ENDPOINTS_MAX);
+  char host[2 * sizeof(endpoints[0].cfg.host)];
+  char buf[sizeof(host) + 256];
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr_chunk(req, "{\"sinks\":[");
+  for (int i = 0; i < sink_count(); i++) {
+    const sink_t *sink = sink_get(i);
+    snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"queued\":%u,\"dropped\":%u,\"sent\":%u,\"failed\":%u,\"retried\":%u}",
+            i ? "," : "", sink->ops->name, sink->queued, sink->dropped, sink->sent, sink->failed, sink->retried);
+    httpd_resp_sendstr_chunk(req, buf);
+  }
+  httpd_resp_sendstr_chunk(req, "],\"loki\":[");
+  for (int i = 0; i < endpoints_num; i++) {
+    loki_endpoint_stat_t *ep = &endpoints[i];
+    snprintf(buf, sizeof(buf), "%s{\"host\":\"%s\",\"port\":%d,\"state\":\"%s\",\"latency_ms\":%u,\"failures\":%d,\"pushes\":%u,\"errors\":%u,\"sent\":%u}",
+            i ? "," : "", json_escape(ep->cfg.host, host, sizeof(host)), ep->cfg.port, endpoint_states[ep->state], ep->latency_ms, ep->failures, ep->pushes, ep->errors, ep->sent);
+    httpd_resp_sendstr_chunk(req, buf);
+  }
+  httpd_resp_sendstr_chunk(req, "]}");
+  httpd_resp_send_chunk(req, NULL, 0);
   return ESP_OK;
 }
 
-static esp_err_t post_handler(httpd_req_t *req) {
+// Returns "" for missing keys so older pages can still post their form
+static char *json_str(cJSON *root, const char *key) {
+  cJSON *item = cJSON_GetObjectItem(root, key);
+  if (!item || !cJSON_IsString(item)) return "";
+  return item->valuestring;
+}
+
+static esp_err_t recv_body(httpd_req_t *req, char *buf, int buf_size) {
   int total_len = req->content_len;
   int cur_len = 0;
-  char buf[SCRATCH_BUFSIZE];
   int received = 0;
-  if (total_len >= SCRATCH_BUFSIZE) {
+  if (total_len >= buf_size) {
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
     return ESP_FAIL;
   }
   while (cur_len < total_len) {
-    received = httpd_req_recv(req, buf + cur_len, total_len);
+    received = httpd_req_recv(req, buf + cur_len, total_len - cur_len);
     if (received <= 0) {
       httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
       return ESP_FAIL;
@@ -118,30 +272,281 @@ static esp_err_t post_handler(httpd_req_t *req) {
   }
 
   buf[total_len] = '\0';
+  return ESP_OK;
+}
+
+static esp_err_t filters_get_handler(httpd_req_t *req) {
+  filter_stat_t stats[FILTER_RULES_MAX];
+  char tag[2 * FILTER_TAG_SIZE];
+  char buf[sizeof(tag) + 192];
+  int num = filter_get_stats(stats, FILTER_RULES_MAX);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr_chunk(req, "{\"rules\":[");
+  for (int i = 0; i < num; i++) {
+    snprintf(buf, sizeof(buf), "%s{\"level\":\"%c\",\"tag\":\"%s\",\"action\":\"%s\",\"arg\":%u,\"matched\":%u,\"dropped\":%u}",
+            i ? "," : "", stats[i].rule.level, json_escape(stats[i].rule.tag, tag, sizeof(tag)), filter_actions[stats[i].rule.action],
+            stats[i].rule.arg, stats[i].matched, stats[i].dropped);
+    httpd_resp_sendstr_chunk(req, buf);
+  }
+  httpd_resp_sendstr_chunk(req, "]}");
+  httpd_resp_send_chunk(req, NULL, 0);
+  return ESP_OK;
+}
+
+// Rules take effect immediately and are saved for the next boot
+static esp_err_t filters_post_handler(httpd_req_t *req) {
+  char buf[FILTERS_BUFSIZE];
+  filters_cfg_t filters_cfg = { .rules_num = 0 };
+  cJSON *item;
 
+  if (recv_body(req, buf, sizeof(buf)) != ESP_OK) return ESP_FAIL;
   cJSON *root = cJSON_Parse(buf);
-  loki_cfg_t loki_cfg;
+  cJSON *rules = root ? cJSON_GetObjectItem(root, "rules") : NULL;
+  if (!rules || !cJSON_IsArray(rules)) {
+    cJSON_Delete(root);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "rules array expected");
+    return ESP_FAIL;
+  }
+  cJSON_ArrayForEach(item, rules) {
+    if (filters_cfg.rules_num >= FILTER_RULES_MAX) break;
+    filter_rule_t *rule = &filters_cfg.rules[filters_cfg.rules_num];
+    const char *level = json_str(item, "level");
+    const char *action = json_str(item, "action");
+    cJSON *arg = cJSON_GetObjectItem(item, "arg");
+    rule->level = level[0] && strchr("EWIDV-", level[0]) ? level[0] : '*';
+    strlcpy(rule->tag, json_str(item, "tag"), sizeof(rule->tag));
+    rule->action = FILTER_KEEP;
+    for (int a = 0; a < sizeof(filter_actions) / sizeof(filter_actions[0]); a++) {
+      if (!strcmp(action, filter_actions[a])) rule->action = a;
+    }
+    rule->arg = arg && cJSON_IsNumber(arg) && arg->valueint > 0 ? arg->valueint : 1;
+    filters_cfg.rules_num++;
+  }
+  cJSON_Delete(root);
+
+  filter_apply(&filters_cfg);
+  set_filters_config(filters_cfg);
+
+  return filters_get_handler(req);
+}
+
+static void url_decode(char *str) {
+  char *out = str, hex[3] = "";
+  for (; *str; str++) {
+    if (*str == '+') {
+      *out++ = ' ';
+    } else if (*str == '%' && isxdigit((unsigned char) str[1]) && isxdigit((unsigned char) str[2])) {
+      hex[0] = str[1];
+      hex[1] = str[2];
+      *out++ = strtol(hex, NULL, 16);
+      str += 2;
+    } else {
+      *out++ = *str;
+    }
+  }
+  *out = '\0';
+}
+
+typedef struct {
+  httpd_req_t *req;
+  int len;
+  char buf[SEARCH_BUFSIZE];
+} search_out_t;
+
+static void search_match(void *arg, int64_t ts_ms, char level, const char *line) {
+  search_out_t *out = (search_out_t *) arg;
+  struct tm timeinfo;
+  time_t sec = ts_ms / 1000;
+
+  if (out->len + LOG_LINE_SIZE + 32 > SEARCH_BUFSIZE) {
+    httpd_resp_send_chunk(out->req, out->buf, out->len);
+    out->len = 0;
+  }
+  gmtime_r(&sec, &timeinfo);
+  out->len += strftime(out->buf + out->len, 24, "%Y-%m-%dT%H:%M:%S", &timeinfo);
+  out->len += sprintf(out->buf + out->len, ".%03dZ %s\n", (int)(ts_ms % 1000), line);
+}
+
+// /search?q=<words>&since=<epoch s or s ago>&level=<EWIDV>&limit=<n>
+static esp_err_t search_get_handler(httpd_req_t *req) {
+  char query_str[256] = "", q[128] = "", param[16];
+  history_query_t query = { .q = q, .since_ms = 0, .levels = 0, .limit = SEARCH_LIMIT };
+  search_out_t *out;
+
+  if (httpd_req_get_url_query_len(req) < sizeof(query_str)) {
+    httpd_req_get_url_query_str(req, query_str, sizeof(query_str));
+  }
+  if (httpd_query_key_value(query_str, "q", q, sizeof(q)) == ESP_OK) url_decode(q);
+  if (httpd_query_key_value(query_str, "since", param, sizeof(param)) == ESP_OK) {
+    long long since = atoll(param);
+    // Small values are relative, "since=300" is the last five minutes. An
+    // empty or 0 value (the form sends "since=" when left blank) is no bound.
+    if (since > 0 && since < 1000000000) since = time(NULL) - since;
+    if (since > 0) query.since_ms = since * 1000;
+  }
+  if (httpd_query_key_value(query_str, "level", param, sizeof(param)) == ESP_OK) {
+    for (char *l = param; *l; l++) {
+      if (strchr("EWIDV", *l)) query.levels |= HISTORY_LEVEL(*l);
+    }
+  }
+  if (httpd_query_key_value(query_str, "limit", param, sizeof(param)) == ESP_OK && atoi(param) > 0) {
+    query.limit = atoi(param);
+  }
+
+  out = (search_out_t *) malloc(sizeof(search_out_t));
+  if (!out) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "out of memory");
+    return ESP_FAIL;
+  }
+  out->req = req;
+  out->len = 0;
+  httpd_resp_set_type(req, "text/plain");
+  history_search(&query, search_match, out);
+  if (out->len) httpd_resp_send_chunk(req, out->buf, out->len);
+  httpd_resp_send_chunk(req, NULL, 0);
+  free(out);
+  return ESP_OK;
+}
+
+// "E=100 W=500", levels left out batch as usual. An empty field keeps the
+// current hold times, so the form doesn't need to be prefilled.
+static void parse_flush_holds(flush_cfg_t *cfg, char *holds) {
+  char *save = NULL;
+  int level;
+  if (!strcmp(holds, "")) return;
+  memset(cfg->hold_ms, 0, sizeof(cfg->hold_ms));
+  for (char *hold = strtok_r(holds, ", ", &save); hold; hold = strtok_r(NULL, ", ", &save)) {
+    level = log_level_idx(toupper((unsigned char) hold[0]));
+    if (hold[0] && hold[1] == '=' && (level || hold[0] == '-')) cfg->hold_ms[level] = atoi(hold + 2);
+  }
+}
+
+// hosts is a comma or space separated list of host[:port]
+static void parse_loki_endpoints(loki_cfg_t *cfg, char *hosts, int default_port) {
+  char *save = NULL, *colon;
+  cfg->endpoints_num = 0;
+  for (char *host = strtok_r(hosts, ", ", &save); host && cfg->endpoints_num < LOKI_ENDPOINTS_MAX; host = strtok_r(NULL, ", ", &save)) {
+    loki_endpoint_cfg_t *ep = &cfg->endpoints[cfg->endpoints_num++];
+    ep->port = default_port;
+    colon = strrchr(host, ':');
+    if (colon) {
+      *colon = '\0';
+      if (atoi(colon + 1) > 0) ep->port = atoi(colon + 1);
+    }
+    strlcpy(ep->host, host, sizeof(ep->host));
+  }
+}
+
+static esp_err_t loadtest_get_handler(httpd_req_t *req) {
+  loadtest_status_t st = loadtest_get_status();
+  char buf[448];
+
+  snprintf(buf, sizeof(buf), "{\"state\":\"%s\",\"rate\":%u,\"steps\":%d,\"last_lost\":%u,\"last_p95_ms\":%u,\"slowest\":\"%s\","
+           "\"pass_rate\":%u,\"fail_rate\":%u,\"lines_per_s\":%u,\"bytes_per_s\":%u,\"p50_ms\":%u,\"p95_ms\":%u,\"p99_ms\":%u,"
+           "\"min_len\":%u,\"max_len\":%u}",
+           loadtest_states[st.state], st.rate, st.ramp.steps, st.last_dropped, st.last_p95_ms, st.slowest,
+           st.ramp.pass_rate, st.ramp.fail_rate, st.ramp.lines_per_s, st.ramp.bytes_per_s, st.ramp.p50_ms, st.ramp.p95_ms, st.ramp.p99_ms,
+           st.ramp.limits.min_len, st.ramp.limits.max_len);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, buf);
+  return ESP_OK;
+}
+
+// {"action": "start", "max_latency_ms": 5000, "max_rate": 20000, "min_len": 48, "max_len": 960}
+// or {"action": "stop"}
+static esp_err_t loadtest_post_handler(httpd_req_t *req) {
+  char buf[SCRATCH_BUFSIZE];
+  loadgen_limits_t limits = {
+    .min_rate = LOADTEST_MIN_RATE,
+    .max_rate = LOADTEST_MAX_RATE,
+    .max_latency_ms = LOADTEST_MAX_LATENCY_MS,
+    .max_drops = 0,
+  };
+  esp_err_t esp_err = ESP_OK;
+  cJSON *item;
+
+  if (recv_body(req, buf, sizeof(buf)) != ESP_OK) return ESP_FAIL;
+  cJSON *root = cJSON_Parse(buf);
+  if (!root) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "JSON expected");
+    return ESP_FAIL;
+  }
+  if (!strcmp(json_str(root, "action"), "stop")) {
+    loadtest_stop();
+  } else {
+    item = cJSON_GetObjectItem(root, "max_latency_ms");
+    if (item && cJSON_IsNumber(item) && item->valueint > 0) limits.max_latency_ms = item->valueint;
+    item = cJSON_GetObjectItem(root, "max_rate");
+    if (item && cJSON_IsNumber(item) && item->valueint > 0) limits.max_rate = item->valueint;
+    item = cJSON_GetObjectItem(root, "min_len");
+    if (item && cJSON_IsNumber(item) && item->valueint > 0 && item->valueint < LOG_LINE_SIZE) limits.min_len = item->valueint;
+    item = cJSON_GetObjectItem(root, "max_len");
+    if (item && cJSON_IsNumber(item) && item->valueint > 0 && item->valueint < LOG_LINE_SIZE) limits.max_len = item->valueint;
+    esp_err = loadtest_start(&limits);
+  }
+  cJSON_Delete(root);
+  if (esp_err != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err == ESP_ERR_INVALID_STATE ? "already running" : "failed to start");
+    return ESP_FAIL;
+  }
+
+  return loadtest_get_handler(req);
+}
+
+static esp_err_t post_handler(httpd_req_t *req) {
+  char buf[SCRATCH_BUFSIZE];
+
+  if (recv_body(req, buf, sizeof(buf)) != ESP_OK) return ESP_FAIL;
+
+  cJSON *root = cJSON_Parse(buf);
+  loki_cfg_t loki_cfg = get_loki_config();
+  char loki_hosts[LOKI_ENDPOINTS_MAX * 136];
   strcpy(sta_ssid, cJSON_GetObjectItem(root, "ssid")->valuestring);
   strcpy(sta_password, cJSON_GetObjectItem(root, "key")->valuestring);
   wifi_save_settings();
   char *transport_str = cJSON_GetObjectItem(root, "lokitransport")->valuestring;
   if (!strcmp(transport_str, "tls")) loki_cfg.transport = HTTP_TRANSPORT_OVER_SSL;
   else loki_cfg.transport = HTTP_TRANSPORT_OVER_TCP;
-  strcpy(loki_cfg.host, cJSON_GetObjectItem(root, "lokihost")->valuestring);
+  strlcpy(loki_hosts, cJSON_GetObjectItem(root, "lokihost")->valuestring, sizeof(loki_hosts));
   char *port_str = cJSON_GetObjectItem(root, "lokiport")->valuestring;
-  if (strcmp(port_str, "")) loki_cfg.port = atoi(port_str);
-  else loki_cfg.port = loki_cfg.transport == HTTP_TRANSPORT_OVER_SSL ? 443 : 80;
+  if (strcmp(port_str, "")) parse_loki_endpoints(&loki_cfg, loki_hosts, atoi(port_str));
+  else parse_loki_endpoints(&loki_cfg, loki_hosts, loki_cfg.transport == HTTP_TRANSPORT_OVER_SSL ? 443 : 80);
+  loki_cfg.mode = strcmp(json_str(root, "lokimode"), "spread") ? LOKI_MODE_FAILOVER : LOKI_MODE_SPREAD;
   strcpy(loki_cfg.username, cJSON_GetObjectItem(root, "lokilogin")->valuestring);
   strcpy(loki_cfg.password, cJSON_GetObjectItem(root, "lokipass")->valuestring);
   strcpy(loki_cfg.name, cJSON_GetObjectItem(root, "lokiname")->valuestring);
   set_loki_config(loki_cfg);
 
+  sinks_cfg_t sinks_cfg = get_sinks_config();
+  if (!strcmp(json_str(root, "syslogtransport"), "tcp")) sinks_cfg.syslog_transport = SINK_TRANSPORT_TCP;
+  else sinks_cfg.syslog_transport = SINK_TRANSPORT_UDP;
+  strlcpy(sinks_cfg.syslog_host, json_str(root, "sysloghost"), sizeof(sinks_cfg.syslog_host));
+  port_str = json_str(root, "syslogport");
+  sinks_cfg.syslog_port = strcmp(port_str, "") ? atoi(port_str) : 514;
+  strlcpy(sinks_cfg.rawtcp_host, json_str(root, "rawtcphost"), sizeof(sinks_cfg.rawtcp_host));
+  port_str = json_str(root, "rawtcpport");
+  sinks_cfg.rawtcp_port = strcmp(port_str, "") ? atoi(port_str) : 5170;
+  set_sinks_config(sinks_cfg);
+
+  flush_cfg_t flush_cfg = get_flush_config();
+  char flush_holds[64];
+  strlcpy(flush_holds, json_str(root, "holds"), sizeof(flush_holds));
+  parse_flush_holds(&flush_cfg, flush_holds);
+  set_flush_config(flush_cfg);
+
   ESP_LOGI(TAG, "SSID: %s", sta_ssid);
   ESP_LOGI(TAG, "Loki Transport: %s", loki_cfg.transport == 2 ? "https" : "http");
-  ESP_LOGI(TAG, "Loki Host: %s", loki_cfg.host);
-  ESP_LOGI(TAG, "Loki Port: %d", loki_cfg.port);
+  for (int i = 0; i < loki_cfg.endpoints_num; i++) {
+    ESP_LOGI(TAG, "Loki Endpoint: %s:%d", loki_cfg.endpoints[i].host, loki_cfg.endpoints[i].port);
+  }
+  ESP_LOGI(TAG, "Loki Mode: %s", loki_cfg.mode == LOKI_MODE_SPREAD ? "spread" : "failover");
   ESP_LOGI(TAG, "Loki Login: %s", loki_cfg.username);
   ESP_LOGI(TAG, "Loki Instance: %s", loki_cfg.name);
+  ESP_LOGI(TAG, "Syslog: %s:%d/%s", sinks_cfg.syslog_host, sinks_cfg.syslog_port, sinks_cfg.syslog_transport == SINK_TRANSPORT_TCP ? "tcp" : "udp");
+  ESP_LOGI(TAG, "Raw TCP: %s:%d", sinks_cfg.rawtcp_host, sinks_cfg.rawtcp_port);
+  ESP_LOGI(TAG, "Hold ms: E=%u W=%u I=%u D=%u V=%u -=%u", flush_cfg.hold_ms[5], flush_cfg.hold_ms[4],
+           flush_cfg.hold_ms[3], flush_cfg.hold_ms[2], flush_cfg.hold_ms[1], flush_cfg.hold_ms[0]);
 
   const char resp[] = "Done. Rebooting...";
   httpd_resp_send(req, resp, strlen(resp));